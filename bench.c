@@ -0,0 +1,324 @@
+// Microbenchmarks and differential fuzzer for grain's core kernels
+// Build: make bench, or cc -O2 -o bench bench.c
+// Usage: ./bench [bench | fuzz [cases [seed]]]
+//
+// bench times getNextField, skipFields, loadFile, substring2Num and num2String over controlled inputs.
+// fuzz compares them against the naive reference implementations below.  When a kernel gains a fast path, leave its
+// reference here unchanged, so any difference in behaviour is reported.  Only update a reference when a
+// change in behaviour is intended.  fuzz also runs a few scripts whose output is known, covering edge cases.
+#define GRAIN_LIBRARY
+#include "grain.c"
+
+/////////////////////////////////////////////////////////////////////////
+// Reference implementations
+
+int refGetNextField(char *txt, char *delimiter, int start, int stop){
+	// First whitespace character, or first place the delimiter starts, from start to stop.  "" matches after each character
+	if (delimiter != NULL && delimiter[0] == 0) return start < stop ? start + 1 : NOT_FOUND;
+	for (int i = start; i < stop; ++i)
+		if (delimiter == NULL ? txt[i] != 0 && strchr(" \t\n", txt[i]) != NULL : strncmp(&txt[i], delimiter, strlen(delimiter)) == 0) return i;
+	return NOT_FOUND;
+}
+
+int refSkipFields(char *txt, struct fieldDict *field, int index, int from, int to){
+	while (index-- && (from = refGetNextField(txt, field->val, from, to)) != -1) from = (field->val == NULL ? skipWhitespace(txt, from) : from + field->len) ;
+	return from;
+}
+
+double refSubstring2Num(char *txt, long *cursors){
+	// Optional minus sign, digits and at most one decimal point, correctly rounded by strtod()
+	char buff[NUM_SIZE];
+	int isNeg = (cursors[START] < cursors[STOP] && txt[cursors[START]] == '-'), length = 0, points = 0;
+	for (int pos = cursors[START] + isNeg; pos < cursors[STOP]; ++pos){
+		if (txt[pos] == '.') ++points;
+		else if (txt[pos] < 48 || txt[pos] > 57) points = 2;
+		if (points > 1) throwError(NOT_NUM, txt, cursors[START], cursors[STOP]);
+		if (length < NUM_SIZE - 1) buff[length++] = txt[pos];
+	}
+	buff[length] = 0;
+	return isNeg ? 0 - strtod(buff, NULL) : strtod(buff, NULL);
+}
+
+int refFormatNum(char *txt, double num){
+	// Five decimal places without trailing zeroes, as printf() rounds them
+	if (!(num > -1e100 && num < 1e100)) return snprintf(txt, NUM_SIZE, "%g", num);
+	int length = snprintf(txt, NUM_SIZE, "%.5f", num);
+	while (txt[length - 1] == '0') --length;
+	if (txt[length - 1] == '.') --length;
+	txt[length] = 0;
+	if (strcmp(txt, "-0") == 0) length = 1, strcpy(txt, "0");
+	return length;
+}
+
+int refSplit(char *txt, int length, char *delimiter, int *starts, int *stops){
+	// Cut txt into records the way loadFile should: each ends at a delimiter, a final unterminated record is kept
+	int count = 0, len = strlen(delimiter);
+	for (int from = 0, at; from < length; from = at + len, ++count){
+		if (len == 0) at = from + 1;
+		else for (at = from; at + len <= length && memcmp(&txt[at], delimiter, len) != 0; ++at);
+		if (at + len > length) at = length;
+		starts[count] = from, stops[count] = at;
+	}
+	return count;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Inputs
+
+unsigned long long seed = 1;
+int randInt(int bound){
+	// xorshift, so cases repeat for a given seed on any platform
+	seed ^= seed << 13, seed ^= seed >> 7, seed ^= seed << 17;
+	return bound > 0 ? seed % bound : 0;
+}
+
+char *delimiters[] = {NULL, ",", "\t", "ab", "aa", "abc", "\r\n", "abab", "--->", "aaaaaaaa", "12345678"};
+#define DELIMITERS (int)(sizeof(delimiters) / sizeof(char *))
+
+void fillFields(char *txt, int length, char *delimiter, int fieldLen){
+	// Fields of around fieldLen characters.  Alphabet includes delimiter characters, so near misses and overlaps occur.
+	char *alphabet = delimiter == NULL ? "abc12 \t\n" : "abc12-> \t";
+	for (int pos = 0; pos < length; ){
+		int run = 1 + randInt(2 * fieldLen);
+		for ( ; run-- && pos < length; ++pos) txt[pos] = alphabet[randInt(delimiter == NULL ? 5 : 9)];
+		if (delimiter == NULL) for (int spaces = 1 + randInt(3); spaces-- && pos < length; ++pos) txt[pos] = " \t\n"[randInt(3)];
+		else for (int j = 0; delimiter[j] && pos < length; ++j, ++pos) txt[pos] = delimiter[j];
+	}
+	txt[length] = 0;
+}
+
+void plantAt(char *txt, int length, char *delimiter, int at){
+	// Place a delimiter so it straddles offset at, such as the READ_SIZE or BATCH_SIZE boundary
+	if (delimiter == NULL) delimiter = " ";
+	int len = strlen(delimiter), from = at - randInt(len + 1);
+	for (int j = 0; j < len && from + j < length; ++j) if (from + j >= 0) txt[from + j] = delimiter[j];
+}
+
+FILE *memFile(char *txt, int length){
+	FILE *fp = tmpfile();
+	fwrite(txt, sizeof(char), length, fp);
+	rewind(fp);
+	return fp;
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Benchmarks
+
+volatile long sink;
+
+void benchFields(){
+	int length = 1 << 20;
+	char *txt = malloc(length + 16);
+	printf("%-14s %-22s %10s\n", "kernel", "case", "ns/byte");
+	for (int fieldLen = 8; fieldLen <= 512; fieldLen *= 64){
+		for (int d = 0; d < DELIMITERS; ++d){
+			fillFields(txt, length, delimiters[d], fieldLen);
+			struct fieldDict field = {NULL, delimiters[d], delimiters[d] == NULL ? 0 : strlen(delimiters[d])};
+			char label[64];
+			snprintf(label, sizeof(label), "%s field, %s", fieldLen == 8 ? "short" : "long", delimiters[d] == NULL ? "space" : delimiters[d]);
+			for (char *c = label; *c; ++c) if (*c == '\t') *c = 'T'; else if (*c == '\r') *c = 'R'; else if (*c == '\n') *c = 'N';
+
+			double start = now();
+			for (int pos = 0, found; pos < length && (found = getNextField(txt, field.val, pos, length)) != NOT_FOUND; )
+				pos = field.val == NULL ? skipWhitespace(txt, found) : found + field.len, sink += found;
+			printf("%-14s %-22s %10.3f\n", "getNextField", label, (now() - start) * 1e9 / length);
+
+			start = now();
+			for (int pos = 0; pos != NOT_FOUND && pos < length; ) pos = skipFields(txt, &field, 100, pos, length), sink += pos;
+			printf("%-14s %-22s %10.3f\n", "skipFields", label, (now() - start) * 1e9 / length);
+		}
+	}
+	free(txt);
+}
+
+void benchLoadFile(){
+	int length = 16 << 20;
+	char *txt = malloc(length + 16), *labels[] = {"\n", "\r\n", "<rec>"};
+	for (int recordLen = 16; recordLen <= 4096; recordLen *= 256){
+		for (int d = 0; d < 3; ++d){
+			fillFields(txt, length, labels[d], recordLen);
+			struct fileDict file = {0};
+			file.delimiter = labels[d], file.len = strlen(labels[d]), file.to = NO_LIMIT, file.fp = memFile(txt, length);
+			long got;
+			char *buff = NULL;
+			double start = now();
+			while ((buff = loadFile(buff, &file, &got, 0)) != NULL) sink += got;
+			char label[64];
+			snprintf(label, sizeof(label), "%s record, %s", recordLen == 16 ? "short" : "long", d == 0 ? "LF" : d == 1 ? "CRLF" : labels[d]);
+			printf("%-14s %-22s %10.3f\n", "loadFile", label, (now() - start) * 1e9 / length);
+			fclose(file.fp), free(file.batch);
+		}
+	}
+	free(txt);
+}
+
+void benchNumbers(){
+	char *numbers[] = {"7", "12345", "-42", "3.25", "123456.789", "0.000123", "18446744073709551615"}, txt[NUM_SIZE];
+	int calls = 1 << 20;
+	for (int n = 0; n < 7; ++n){
+		long cursors[2] = {0, strlen(numbers[n])};
+		double start = now();
+		for (int call = 0; call < calls; ++call) sink += substring2Num(numbers[n], cursors);
+		printf("%-14s %-22s %10.3f ns/call\n", "substring2Num", numbers[n], (now() - start) * 1e9 / calls);
+	}
+	double values[] = {0, 7, -42, 3.25, 123456.789, 0.1};
+	for (int n = 0; n < 6; ++n){
+		double start = now();
+		for (int call = 0; call < calls; ++call) sink += formatNum(txt, values[n]);
+		char label[32];
+		snprintf(label, sizeof(label), "%g", values[n]);
+		printf("%-14s %-22s %10.3f ns/call\n", "num2String", label, (now() - start) * 1e9 / calls);
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Differential fuzzing
+
+int mismatches = 0;
+void mismatch(char *kernel, char *detail){
+	if (++mismatches <= 10) printf("MISMATCH %s: %s (seed %llu)\n", kernel, detail, seed);
+}
+
+int fuzzNumber(char *txt, long *cursors, double (*parse)(char *, long *), double *result){
+	// Returns TRUE if parse rejected txt
+	long copy[2] = {cursors[START], cursors[STOP]};
+	if (setjmp(grain->fail)) return TRUE;
+	*result = parse(txt, copy);
+	return FALSE;
+}
+
+void fuzz(int cases){
+	char *txt = malloc(3 * BATCH_SIZE + 16), detail[2 * NUM_SIZE + 64];
+	int *starts = malloc(3 * BATCH_SIZE * sizeof(int)), *stops = malloc(3 * BATCH_SIZE * sizeof(int));
+	for (int c = 0; c < cases; ++c){
+		// Fields: random spans of a buffer straddling READ_SIZE
+		char *delimiter = delimiters[randInt(DELIMITERS)];
+		int length = 1 + randInt(3 * READ_SIZE);
+		fillFields(txt, length, delimiter, 1 + randInt(20));
+		plantAt(txt, length, delimiter, READ_SIZE);
+		struct fieldDict field = {NULL, delimiter, delimiter == NULL ? 0 : strlen(delimiter)};
+		int start = randInt(length), stop = start + randInt(length - start + 1), index = randInt(12);
+		if (getNextField(txt, delimiter, start, stop) != refGetNextField(txt, delimiter, start, stop))
+			snprintf(detail, sizeof(detail), "'%s' from %i to %i", delimiter == NULL ? "space" : delimiter, start, stop), mismatch("getNextField", detail);
+		if (skipFields(txt, &field, index, start, stop) != refSkipFields(txt, &field, index, start, stop))
+			snprintf(detail, sizeof(detail), "'%s' index %i from %i to %i", delimiter == NULL ? "space" : delimiter, index, start, stop), mismatch("skipFields", detail);
+
+		// Numbers: mostly valid, sometimes not.  Up to 64 bit whole parts, long fractions and leading zeroes.
+		// Each random draw is its own statement, so the order of draws, and so each case, is fixed for a given seed
+		char number[64], *minus = randInt(4) ? "" : "-";
+		unsigned long long integer = seed >> randInt(64);
+		char *point = randInt(2) ? "." : "", *zeroes = randInt(4) ? "" : "000";
+		unsigned long long fraction = seed % (randInt(2) ? 100000 : 1000000000000ULL);
+		int digits = snprintf(number, sizeof(number), "%s%llu%s%s%llu", minus, integer, point, zeroes, fraction);
+		if (randInt(10) == 0){
+			int at = randInt(digits);
+			number[at] = "x .-"[randInt(4)];
+		}
+		long cursors[2] = {0, randInt(digits + 1)};
+		double got, want;
+		int gotErr = fuzzNumber(number, cursors, substring2Num, &got), wantErr = fuzzNumber(number, cursors, refSubstring2Num, &want);
+		if (gotErr != wantErr || !gotErr && memcmp(&got, &want, sizeof(double)) != 0)
+			snprintf(detail, sizeof(detail), "'%.*s' gave %.17g, expected %.17g", (int)cursors[STOP], number, got, want), mismatch("substring2Num", detail);
+
+		// Include exact ties such as 1/64, values a hair either side of them, and huge numbers
+		char formatted[NUM_SIZE], reference[NUM_SIZE];
+		int sign = randInt(2) ? -1 : 1, numerator = randInt(1000000), denominator = 1 + randInt(1000);
+		double value = sign * (double)numerator / denominator;
+		if (randInt(4) == 0){
+			numerator = randInt(100000), denominator = 1 << randInt(12);
+			value = (double)numerator / denominator;
+		}
+		if (randInt(8) == 0) value *= 1 + (randInt(2) ? 1e-15 : -1e-15);
+		if (randInt(16) == 0) value *= 1e12 * (1 + randInt(1000000));
+		formatNum(formatted, value), refFormatNum(reference, value);
+		if (strcmp(formatted, reference) != 0)
+			snprintf(detail, sizeof(detail), "%.17g gave '%s', expected '%s'", value, formatted, reference), mismatch("num2String", detail);
+
+		// Whole numbers within 64 bits survive a parse and format round trip exactly
+		int shift = randInt(64);
+		long long whole = (long long)(seed >> shift);
+		snprintf(reference, sizeof(reference), "%lld", whole);
+		formatNumber(formatted, string2Number(reference));
+		if (strcmp(formatted, reference) != 0)
+			snprintf(detail, sizeof(detail), "'%s' gave '%s'", reference, formatted), mismatch("formatNumber", detail);
+
+		// Records: a file straddling the batch size, every tenth case
+		if (c % 10) continue;
+		char *fileDelimiters[] = {"\n", "\r\n", "aa", "abab", "<rec>", ""};
+		delimiter = fileDelimiters[randInt(6)];
+		length = delimiter[0] ? randInt(3 * BATCH_SIZE) : randInt(2 * READ_SIZE);
+		fillFields(txt, length, delimiter, randInt(8) ? 1 + randInt(40) : BATCH_SIZE);
+		plantAt(txt, length, delimiter, BATCH_SIZE);
+		int records = refSplit(txt, length, delimiter, starts, stops), record = 0;
+		long recordLen;
+
+		struct fileDict file = {0};
+		file.delimiter = delimiter, file.len = strlen(delimiter), file.to = NO_LIMIT, file.fp = memFile(txt, length);
+		char *buff = NULL;
+		for ( ; (buff = loadFile(buff, &file, &recordLen, 0)) != NULL; ++record){
+			if (record >= records || recordLen != stops[record] - starts[record] || memcmp(buff, &txt[starts[record]], recordLen) != 0){
+				snprintf(detail, sizeof(detail), "'%s' record %i of %i differs in a %i byte file", delimiter, record, records, length), mismatch("loadFile", detail);
+				free(buff);
+				break;
+			}
+		}
+		if (buff == NULL && record != records)
+			snprintf(detail, sizeof(detail), "'%s' gave %i records, expected %i", delimiter, record, records), mismatch("loadFile", detail);
+		fclose(file.fp), free(file.batch);
+	}
+	printf("fuzz: %i cases, %i mismatches\n", cases, mismatches);
+	free(txt), free(starts), free(stops);
+}
+
+/////////////////////////////////////////////////////////////////////////
+// Script checks
+
+#define CHECK_SIZE (READ_SIZE + 16)
+
+struct check {
+	char *script;
+	char *output;
+};
+
+struct check checks[] = {
+	// Aggregates over nothing: min, max and mean are empty, not 0
+	{"file t(\"/dev/null\")\nfield c(\" \")\nprint \"[\" min(t.c[1]) \"|\" max(t.c) \"|\" mean(t) \"|\" sum(t.c[1]) \"|\" count(t) \"]\"\n", "[|||0|0]"},
+	{"field c(\",\")\nin \"1,,3\"\n\tprint \"[\" min(c) \"|\" max(c) \"|\" mean(c) \"]\"\nout\n", "[1|3|2]"},
+	{"field c(\",\")\nin \",\"\n\tprint \"[\" min(c) \"|\" max(c) \"|\" mean(c) \"|\" count(c) \"]\"\nout\n", "[|||0]"},
+};
+
+void captureOutput(void *user, char *txt, int length){
+	// print callback: append to user, a CHECK_SIZE buffer
+	int used = strlen(user);
+	if (length > CHECK_SIZE - 1 - used) length = CHECK_SIZE - 1 - used;
+	memcpy((char *)user + used, txt, length), ((char *)user)[used + length] = 0;
+}
+
+void checkScripts(){
+	char output[CHECK_SIZE], detail[2 * CHECK_SIZE + 64];
+	for (int c = 0; c < (int)(sizeof(checks) / sizeof(struct check)); ++c){
+		struct grain *context = grainNew();
+		output[0] = 0;
+		grainOutput(context, captureOutput, output);
+		if (grainRunString(context, checks[c].script)) snprintf(output, sizeof(output), "%s", grainError(context));
+		if (strcmp(output, checks[c].output) != 0)
+			snprintf(detail, sizeof(detail), "check %i gave '%s', expected '%s'", c, output, checks[c].output), mismatch("script", detail);
+		grainFree(context);
+	}
+}
+
+int main(int argc, char **argv){
+	grain = grainNew();
+	if (argc > 1 && strcmp(argv[1], "fuzz") == 0){
+		if (argc > 3) seed = strtoull(argv[3], NULL, 10);
+		checkScripts();
+		fuzz(argc > 2 ? atoi(argv[2]) : 10000);
+	}
+	else {
+		benchFields();
+		benchLoadFile();
+		benchNumbers();
+	}
+	grainFree(grain);
+	return mismatches != 0;
+}
@@ -1,36 +1,141 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <poll.h>
+#include <limits.h>
+#include <time.h>
+#include "grain.h"
 
 #define READ_SIZE 500
+#define SCAN_SIZE 65536
+#define BATCH_SIZE 65536
+#define MAP_SIZE (1L << 24)
+#define SIDECAR_VERSION 1
+#define SMALL_SIZE 24
+#define NUM_SIZE 128
+#define METRICS_INTERVAL 10
+#define COLUMN_RECORDS 4096
+#define CLIENT_TIMEOUT 10
+#ifndef GRAIN_SOURCE
+#define GRAIN_SOURCE __FILE__
+#endif
 enum position	{START, STOP};
 enum boolean	{FALSE, TRUE};
-enum iterators 	{FILE_ITER = 0, FIELD_ITER = 1, VAR = 2};
+enum iterators 	{FILE_ITER = 0, FIELD_ITER = 1, VAR = 2, LITERAL = 3};
 enum comparator {LE = 0, LT = 1, GE = 2, GT = 3, EQ = 4, NE = 5};
-enum null 	{NOT_FOUND = -1, NO_INDEX = -1, NO_LOOP = -1, STRING = -1};
-enum errors 	{OOR, NO_DOLLAR, NO_BUFFER, NO_FILE_ITER, INDEX_VAR, NOT_EXIST, NOT_NUM, ASSIGN, EXISTS, ESC_SEQ, NO_EQUALS, NO_FI, NO_OUT};
+enum null 	{NOT_FOUND = -1, NO_INDEX = -1, NO_LOOP = -1, STRING = -1, NO_LIMIT = -1};
+enum errors 	{OOR, NO_DOLLAR, NO_BUFFER, NO_FILE_ITER, INDEX_VAR, NOT_EXIST, NOT_NUM, ASSIGN, EXISTS, ESC_SEQ, NO_EQUALS, NO_FI, NO_OUT, BORROWED, BAD_TOKEN, NO_FILE, MODULO, TOO_BIG, NO_SEEK};
+enum aggregates {SUM = 0, MIN = 1, MAX = 2, MEAN = 3, COUNT = 4, OCCURS = 5};
 enum tokenType 	{TERMINATOR = 6, QUOTE = 7, VARIABLE = 8, COMMA = 9, ASSIGNMENT = 10, DOLLAR = 11, MATHS = 12, NUMBER = 13}; 
+enum entryType {PRINT, TEST, SKIP, STR_ASS, MTH_ASS};
+
+struct sidecar {
+	int field;		// field iterator whose offsets are cached
+	long records;		// number of records
+	long next;		// record expected to be looked up next
+	long *offsets;		// byte offset of each record in the file
+	long *first;		// index into starts of each record's first field, records + 1 entries
+	int *starts;		// start of each field, relative to its record
+	void *map;		// mapped sidecar file
+	size_t size;		// length of map
+};
+
+struct sidecarHeader {
+	char magic[4];		// "GRNC"
+	int version;
+	long size;		// size of the cached file
+	long mtime;		// modification time of the cached file
+	int fileLen;		// length of record delimiter, stored after header
+	int fieldLen;		// length of field delimiter, stored after record delimiter.  -1 = whitespace
+	long records;
+	long starts;
+};
+
+struct fileMetrics {
+	int opens;		// times the iterator has been (re)defined
+	long bytes;		// bytes read
+	long records;		// records loaded
+	long refills;		// batch refills
+	long seeks;		// fseek calls
+	long grows;		// times the batch, a rest-of-file buffer or the record buffer grew past its largest size yet
+	long longest;		// longest record loaded
+	long size;		// size of current file, or -1 if unknown
+};
 
 struct fileDict {
 	char *key; 		// filename
+	char *name;		// path of opened file
 	char *delimiter; 	// delimiter
 	int len;		// length of delimiter
+	int whole;		// TRUE if the entire file is loaded as one record
+	int mappable;		// TRUE if records may be mapped from the file rather than read into memory
+	long from;		// byte offset at which the range starts
+	long to;		// byte offset at which the range stops, or NO_LIMIT
+	char *checkpoint;	// follow mode: file storing the offset of the next unread record
+	int wait;		// follow mode: seconds between polls for new data, 0 = do not wait
+	char *batch;		// block of records read ahead of the current record
+	long batchCap;		// capacity of batch
+	long batchLen;		// bytes held in batch
+	long batchPos;		// start of the next unread record in batch
+	long origin;		// byte offset of the record loaded most recently
+	struct sidecar *cache;	// field offsets loaded from sidecar file, or NULL
+	struct fileMetrics metrics;
 	FILE *fp;
 };
 
 struct fileStruct {
 	int count;
 	struct fileDict *dict;
-} files;
+};
 
 struct varDict {
 	char *key;
-	char *val; 
+	char *val; 		// points at small until the value outgrows it
+	long cap;		// bytes available at val
+	char small[SMALL_SIZE];	// inline storage for short values
 };
 
 struct varStruct {
 	int count;
 	struct varDict *dict;
-} vars;
+};
+
+struct scratchBuffer {
+	char *txt;	// string assignments are built here before being copied into the variable
+	long cap;
+};
+
+struct owned {
+	void *ptr;	// heap buffer held across a throwError(), or NULL
+	int used;	// FALSE once handed back by its owner
+};
+
+struct ownedBuffers {
+	struct owned *list;
+	int count;
+	int cap;
+};
+
+struct mapped {
+	char *record;	// record returned by loadFile()
+	void *area;	// start of the mapping holding it
+	size_t size;	// length of the mapping
+};
+
+struct mappedRecords {
+	struct mapped *list;
+	int count;
+	int cap;
+};
 
 struct fieldDict {
 	char *key;
@@ -41,81 +146,274 @@ struct fieldDict {
 struct fieldStruct {
 	int count;
 	struct fieldDict *dict;
-} fields;
+};
 
 struct loopStruct {
-	int type; 	// 0 = file  ; 1 = field
+	int type; 	// 0 = file  ; 1 = field ; 2 = variable ; 3 = literal
 	int isLoop;	// 0 = false ; 1 = true
 	int addr;	// address offet to find relevant file/field struct
 	int index;	// occurence of file/field iterator to locate
 	int chain;	// 0 =  false; 1 = true
 	long cmd; 	// fseek to start of loop in script
-	char *buff;
-	int start;
-	int stop;
+	long origin;	// FILE_ITER: byte offset of buff within the file
+	char *buff;	// VAR: borrowed from the variable.  FILE_ITER and LITERAL: owned by the loop
+	long start;
+	long stop;
 };
 
 struct loopStack {
 	int ptr;	// stack pointer
 	int cap;	// stack capacity
 	struct loopStruct *stack;
-} loops;
+};
+
+struct number {
+	int isWhole;	// TRUE if held exactly in whole
+	long long whole;
+	double real;	// value as a double, whether or not it is whole
+};
+
+struct operand {
+	int type;	// QUOTE: literal txt[start-stop] ; DOLLAR ; VARIABLE: variable addr ; FIELD_ITER: field addr[index]
+	char *txt;
+	long start;
+	long stop;
+	int addr;
+	int index;
+	int indexVar;	// FIELD_ITER: variable index was read from, or NOT_FOUND
+	char op;	// MTH_ASS: operator applied with this operand
+	int slot;	// PRINT, FIELD_ITER: column of spans located for it, or NOT_FOUND
+};
+
+struct test {
+	struct operand a;
+	struct operand b;
+	int operator;	// LE to NE, or VARIABLE for 'inc' and 'exc'
+	int inc;	// TRUE for 'inc'
+	char link;	// 'a' if 'and' follows, 'o' if 'or' follows, otherwise 0
+};
+
+struct columnEntry {
+	int type;		// PRINT, TEST, SKIP, STR_ASS or MTH_ASS
+	int first;		// first operand, or test
+	int count;		// number of operands, or tests
+	int jump;		// TEST: entry run next if the test fails.  SKIP: entry run next
+	int var;		// STR_ASS, MTH_ASS: variable assigned
+	int declared;		// MTH_ASS: 'var' statement, so starting from zero
+	int slot;		// MTH_ASS: column of results
+	int readable;		// MTH_ASS: FALSE if the variable no longer reads as a number
+	struct number now;	// MTH_ASS: the variable, as the next record reads it
+};
+
+struct columnBuffers {
+	// Plan of the loop body
+	char **lines;
+	int *lineEntry;		// first entry of each line
+	char *lineKind;		// i, e, l or f for if, elif, else and fi lines, otherwise 0
+	int lineCap;
+	struct columnEntry *entries;
+	int entryCount, entryCap;
+	struct operand *operands;
+	int operandCount, operandCap;
+	struct test *tests;
+	int testCount, testCap;
+	int spanCount, resultCount;
+	// Batch being run, COLUMN_RECORDS records at most
+	long *records;		// start and stop of each record in the batch
+	char *saved;		// byte overwritten to terminate each record
+	int *next;		// entry each record runs next
+	char *ran;		// per entry, TRUE for each record it ran over
+	long *spans;		// per column, start and stop of the field in each record
+	struct number *results;	// per column, the variable's value after each record
+};
+
+struct aggregate {
+	int type;	// SUM, MIN, MAX, MEAN, COUNT or OCCURS
+	long count;	// number of non-empty values seen, or delimiters found
+	int field;	// OCCURS: field iterator whose delimiter is counted
+	struct number sum;
+	struct number min;
+	struct number max;
+};
+
+struct value {
+	// Compiled script: a token's value, txt[curs[START]-curs[STOP]], or all of txt if curs[START] == STRING
+	char *txt;		// NULL until needed, if isNum
+	long curs[2];
+	int isNum;		// TRUE if num holds the value
+	struct number num;
+	char buff[NUM_SIZE];
+};
+
+struct nameDict {
+	// Compiled script: a name declared by the script
+	char *key;
+	int kind;		// FILE_ITER, FIELD_ITER or VAR.  NOT_FOUND if declared as more than one
+	int local;		// VAR: TRUE if only ever assigned numbers, so held in a C local rather than vars.dict
+};
 
-void throwError(int errNum, char *errStr, int errA, int errB){
+struct compiler {
+	FILE *out;		// where C is written: code, or spare
+	FILE *code;		// C for the current line, written to source if the line compiles
+	FILE *spare;
+	char *codeTxt, *spareTxt;
+	size_t codeSize, spareSize;
+	FILE *scriptFile;
+	FILE *source;
+	char **lines;
+	int lineCount;
+	struct nameDict *names;
+	int nameCount;
+	char *blocks;		// i or f for each open in or if block
+	int depth;		// blocks open at the current line
+};
+
+struct grain {
+	struct fileStruct files;
+	struct varStruct vars;
+	struct scratchBuffer scratch;
+	struct fieldStruct fields;
+	struct loopStack loops;
+	struct loopStack chain;					// links parsed by parseChain()
+	struct ownedBuffers owned;				// freed by grainExecute() if the script fails
+	struct mappedRecords mapped;				// records mapped from their file, unmapped by freeRecord()
+	struct fileDict scan;					// file read by writeSidecar()
+	struct columnBuffers columns;				// batch being run by columnLoop()
+	void (*output)(void *user, char *txt, int length);	// print destination, or NULL for stdout
+	void *outputUser;
+	FILE *(*open)(void *user, char *path);			// opens file iterators, or NULL for fopen
+	void *openUser;
+	jmp_buf fail;						// throwError returns here
+	char message[READ_SIZE];				// last error
+	FILE *metrics;						// progress reports, or NULL
+	int metricsInterval;					// seconds between reports
+	double metricsStart, metricsLast;
+};
+
+// Context of the script running on this thread
+_Thread_local struct grain *grain = NULL;
+
+_Noreturn void throwError(int errNum, char *errStr, long errA, long errB){
 	// errA and errB are used to pass integers, they could be represent types or substring coordinates.  Set to -1 if unused.
+	// Unwinds to the running context, which reports the error.  Exits if there is none.
+	char local[READ_SIZE], *message = grain == NULL ? local : grain->message;
 	switch(errNum){
 	case OOR:
-		fprintf(stderr, "ERROR: %s iterator '%s[%i]' is out of range.\n", errB == FIELD_ITER ? "field" : "file", errStr, errA);
+		snprintf(message, READ_SIZE, "ERROR: %s iterator '%s[%ld]' is out of range.\n", errB == FIELD_ITER ? "field" : "file", errStr, errA);
 		break;
 	case NO_DOLLAR:
-		fprintf(stderr, "ERROR: expected dollar '$'.  Found '%c'.\n", *errStr);
+		snprintf(message, READ_SIZE, "ERROR: expected dollar '$'.  Found '%c'.\n", *errStr);
 		break;
 	case NO_BUFFER:
-		fprintf(stderr, "ERROR: no buffer set.  Asterisk '*' only relevant within an 'in' block.\n");
+		snprintf(message, READ_SIZE, "ERROR: no buffer set.  Asterisk '*' only relevant within an 'in' block.\n");
 		break;
 	case NO_FILE_ITER:
 		if (errB != -1) errStr[errB]=0;
-		fprintf(stderr, "ERROR: field iterator '%s' cannot be used without first reading into a file iterator.\n", errB != -1 ? &errStr[errA] : errStr);
+		snprintf(message, READ_SIZE, "ERROR: field iterator '%s' cannot be used without first reading into a file iterator.\n", errB != -1 ? &errStr[errA] : errStr);
 		break;
 	case INDEX_VAR:
-		fprintf(stderr, "ERROR: variable '%s' cannot be indexed.\n", errStr);
+		snprintf(message, READ_SIZE, "ERROR: variable '%s' cannot be indexed.\n", errStr);
 		break;
 	case NOT_EXIST:
 		errStr[errB]=0;
-		fprintf(stderr, "ERROR: '%s' does not exist.\n", &errStr[errA]);
+		snprintf(message, READ_SIZE, "ERROR: '%s' does not exist.\n", &errStr[errA]);
 		break;
 	case NO_INDEX:
-		fprintf(stderr, "ERROR: %s iterator '%s' requires an index in this context.\n", errB == FIELD_ITER ? "field" : "file", errStr);
+		snprintf(message, READ_SIZE, "ERROR: %s iterator '%s' requires an index in this context.\n", errB == FIELD_ITER ? "field" : "file", errStr);
 		break;
 	case NOT_NUM:
 		if (errB != -1) errStr[errB] = 0;
-		fprintf(stderr, "ERROR: '%s' is not a valid number.\n", errB != -1 ? &errStr[errA] : errStr);
+		snprintf(message, READ_SIZE, "ERROR: '%s' is not a valid number.\n", errB != -1 ? &errStr[errA] : errStr);
 		break;
 	case ASSIGN:
-		fprintf(stderr, "ERROR: %s iterator '%s' cannot be assigned to.\n", errA == FIELD_ITER ? "field" : "file", errStr);
+		snprintf(message, READ_SIZE, "ERROR: %s iterator '%s' cannot be assigned to.\n", errA == FIELD_ITER ? "field" : "file", errStr);
 		break;
 	case EXISTS:
-		fprintf(stderr, "ERROR: '%s' already exists as %s.\n", errStr, errA == FIELD_ITER ? "field iterator" : (errA == FILE_ITER ? "file iterator" : "variable"));
+		snprintf(message, READ_SIZE, "ERROR: '%s' already exists as %s.\n", errStr, errA == FIELD_ITER ? "field iterator" : (errA == FILE_ITER ? "file iterator" : "variable"));
 		break;
 	case ESC_SEQ:
-		fprintf(stderr, "ERROR: '\\%c' escape sequence not recognised.  Valid escape sequences include \\n, \\t, \\\\, \\', \\` and \\\".\n", *errStr);
+		snprintf(message, READ_SIZE, "ERROR: '\\%c' escape sequence not recognised.  Valid escape sequences include \\n, \\t, \\\\, \\', \\` and \\\".\n", *errStr);
 		break;
 	case NO_EQUALS:
-		fprintf(stderr, "ERROR: expected equals '=' assignment operator.  Found '%c'.\n", *errStr);
+		snprintf(message, READ_SIZE, "ERROR: expected equals '=' assignment operator.  Found '%c'.\n", *errStr);
 		break;
 	case NO_FI:
-		fprintf(stderr, "ERROR: 'if' block without closing 'fi' statement.\n");
+		snprintf(message, READ_SIZE, "ERROR: 'if' block without closing 'fi' statement.\n");
 		break;
 	case NO_OUT:
-		fprintf(stderr, "ERROR: 'in' block without closing 'out' statement.\n");
+		snprintf(message, READ_SIZE, "ERROR: 'in' block without closing 'out' statement.\n");
+		break;
+	case BORROWED:
+		snprintf(message, READ_SIZE, "ERROR: variable '%s' cannot be assigned to inside an 'in' loop over it.\n", errStr);
+		break;
+	case BAD_TOKEN:
+		snprintf(message, READ_SIZE, "ERROR: '%s' not recognised.\n", errStr);
+		break;
+	case NO_FILE:
+		snprintf(message, READ_SIZE, "ERROR: cannot open '%s'.\n", errStr);
+		break;
+	case MODULO:
+		snprintf(message, READ_SIZE, "ERROR: modulo needs non-zero whole numbers within 64 bits.  Found '%s'.\n", errStr);
+		break;
+	case TOO_BIG:
+		snprintf(message, READ_SIZE, "ERROR: cannot load a record of file iterator '%s'.  Records that cannot be mapped from a regular file must fit in memory.\n", errStr);
+		break;
+	case NO_SEEK:
+		snprintf(message, READ_SIZE, "ERROR: file iterator '%s' reads a stream, which cannot be given a byte range, followed or cached.\n", errStr);
 		break;
 	}
+	if (grain != NULL) longjmp(grain->fail, errNum + 1);
+	fputs(message, stderr);
 	exit(errNum);
 }
 
-int getNextToken(char *txt, int *cursors){
+int own(void *ptr){
+	// Register ptr with the running context, so it is freed if a throwError() unwinds past its owner.  Returns its slot.
+	struct ownedBuffers *owned = &grain->owned;
+	if (owned->count == owned->cap) owned->list = realloc(owned->list, (owned->cap = owned->cap ? owned->cap * 2 : 16) * sizeof(struct owned));
+	owned->list[owned->count] = (struct owned){ptr, TRUE};
+	return owned->count++;
+}
+
+void reown(int slot, void *ptr){
+	// Buffer in slot was reallocated
+	grain->owned.list[slot].ptr = ptr;
+}
+
+void disown(int slot){
+	// Owner has freed or kept the buffer in slot
+	struct ownedBuffers *owned = &grain->owned;
+	owned->list[slot] = (struct owned){NULL, FALSE};
+	while (owned->count && owned->list[owned->count - 1].used == FALSE) --owned->count;
+}
+
+int mappedSlot(char *buff){
+	// Index of buff in the mapped records, or NOT_FOUND if it is on the heap
+	for (int m=0; buff != NULL && m < grain->mapped.count; ++m) if (grain->mapped.list[m].record == buff) return m;
+	return NOT_FOUND;
+}
+
+void freeRecord(char *buff){
+	// Free a buffer that may be a record mapped by loadFile()
+	int m = mappedSlot(buff);
+	if (m == NOT_FOUND) free(buff);
+	else {
+		munmap(grain->mapped.list[m].area, grain->mapped.list[m].size);
+		grain->mapped.list[m] = grain->mapped.list[--grain->mapped.count];
+	}
+}
+
+void releaseOwned(){
+	// Free buffers stranded by throwError(), and the sidecar scan if one was cut short
+	for (struct ownedBuffers *owned = &grain->owned; owned->count; --owned->count) freeRecord(owned->list[owned->count - 1].ptr);
+	if (grain->scan.fp != NULL) fclose(grain->scan.fp);
+	free(grain->scan.batch);
+	grain->scan = (struct fileDict){0};
+}
+
+int scanToken(char *txt, long *cursors, int *error){
 	// Moves cursors[START] and cursors[STOP] around next token
-	// Returns int representing type of token found
+	// Returns int representing type of token found, or NOT_FOUND with the error in *error and txt left as it was
 
 	// START scans from *after* END
 	cursors[START] = cursors[STOP] + 1;
@@ -168,8 +466,8 @@ int getNextToken(char *txt, int *cursors){
 			return NE;
 		}
 		else {
-			fprintf(stderr, "! token unrecognised\n");
-			exit(1);
+			*error = BAD_TOKEN;
+			return NOT_FOUND;
 		}
 	case '+':
 	case '-':
@@ -183,31 +481,21 @@ int getNextToken(char *txt, int *cursors){
 	case '`':
 		// Found quote.  Scan to matching quotation mark.
 		for (cursors[STOP] = cursors[START] + 1; txt[cursors[STOP]] != txt[cursors[START]] ; ++cursors[STOP]){
-			// Check for escape character.  If found, shuffle string left and convert.
+			// An unterminated quote must not scan past the end of the line.
+			if (txt[cursors[STOP]] == 0){
+				*error = BAD_TOKEN;
+				return NOT_FOUND;
+			}
+			// Check for escape character.  If found, check it, then shuffle string left and convert.
 			if (txt[cursors[STOP]] == '\\'){
-				for (int i=cursors[STOP], j=cursors[STOP]+1; txt[i]!=0; ++i, ++j) txt[i] = txt[j];
-				switch (txt[cursors[STOP]]){
-				case 'n':
-					txt[cursors[STOP]] = '\n';
-					break;
-				case 't':
-					txt[cursors[STOP]] = '\t';
-					break;
-				case '\\':
-					txt[cursors[STOP]] = '\\';
-					break;
-				case '\'':
-					txt[cursors[STOP]] = '\'';
-					break;
-				case '"':
-					txt[cursors[STOP]] = '"';
-					break;
-				case '`':
-					txt[cursors[STOP]] = '`';
-					break;
-				default:
-					throwError(ESC_SEQ, &txt[cursors[STOP]], -1, -1);
+				if (txt[cursors[STOP]+1] == 0 || strchr("nt\\'\"`", txt[cursors[STOP]+1]) == NULL){
+					++cursors[STOP];
+					*error = ESC_SEQ;
+					return NOT_FOUND;
 				}
+				for (long i=cursors[STOP], j=cursors[STOP]+1; txt[i]!=0; ++i, ++j) txt[i] = txt[j];
+				if (txt[cursors[STOP]] == 'n') txt[cursors[STOP]] = '\n';
+				else if (txt[cursors[STOP]] == 't') txt[cursors[STOP]] = '\t';
 			}
 		}
 		++cursors[START];
@@ -228,7 +516,9 @@ int getNextToken(char *txt, int *cursors){
 					           && txt[cursors[STOP]] != 0 
 					           && txt[cursors[STOP]] != '=' 
 						   && txt[cursors[STOP]] != ';'
-						   && txt[cursors[STOP]] != ',' ; ++cursors[STOP]);
+						   && txt[cursors[STOP]] != ','
+						   && txt[cursors[STOP]] != ')'
+						   && txt[cursors[STOP]] != ']' ; ++cursors[STOP]);
 		return NUMBER;
 	default:
 		for (cursors[STOP] = cursors[START]+1; txt[cursors[STOP]] != ' ' 
@@ -247,10 +537,19 @@ int getNextToken(char *txt, int *cursors){
 	}
 }
 
-int substringEquals(char *comp, char *txt, int *cursors){
+int getNextToken(char *txt, long *cursors){
+	// scanToken(), raising any error
+	int error, type = scanToken(txt, cursors, &error);
+	if (type == NOT_FOUND && error == ESC_SEQ) throwError(ESC_SEQ, &txt[cursors[STOP]], -1, -1);
+	else if (type == NOT_FOUND && txt[cursors[START]] == '!') throwError(BAD_TOKEN, "!", -1, -1);
+	else if (type == NOT_FOUND) throwError(BAD_TOKEN, &txt[cursors[START]], -1, -1);
+	return type;
+}
+
+int substringEquals(char *comp, char *txt, long *cursors){
 	// Checks if comp matches txt[START-STOP]
 	int compPos=0;
-	for (int txtPos=cursors[START]; txtPos < cursors[STOP]; ++compPos, ++txtPos) if (comp[compPos] != txt[txtPos]) return FALSE;
+	for (long txtPos=cursors[START]; txtPos < cursors[STOP]; ++compPos, ++txtPos) if (comp[compPos] != txt[txtPos]) return FALSE;
 	return comp[compPos] == 0;
 }
 
@@ -260,11 +559,11 @@ int stringEquals(char *comp, char *txt){
 	return TRUE;
 }
 
-char *substringSave(char *dest, char *source, int *cursors){
+char *substringSave(char *dest, char *source, long *cursors){
 	// Reallocate dest and copy source[START-STOP] into dest
 	dest = realloc(dest, (1 + cursors[STOP] - cursors[START]) * sizeof(char));
 	dest[cursors[STOP]-cursors[START]] = 0;
-	for (int destPos=0; cursors[START] < cursors[STOP]; ++cursors[START], ++destPos) dest[destPos] = source[cursors[START]]; 
+	for (long destPos=0; cursors[START] < cursors[STOP]; ++cursors[START], ++destPos) dest[destPos] = source[cursors[START]]; 
 	return dest;
 }
 
@@ -280,25 +579,25 @@ char *stringSave(char *dest, char *source){
 	return dest;
 }
 
-int findVar(char *txt, int *cursors){
+int findVar(char *txt, long *cursors){
 	// Returns index of var in varDict where key matches txt substring.  Or -1
-	for (int v=0; v < vars.count; ++v) if (substringEquals(vars.dict[v].key, txt, cursors)) return v;
+	for (int v=0; v < grain->vars.count; ++v) if (substringEquals(grain->vars.dict[v].key, txt, cursors)) return v;
 	return NOT_FOUND;
 }
 
-int findFileIter(char *txt, int *cursors){
+int findFileIter(char *txt, long *cursors){
 	// Returns index of file in fileDict where key matches txt substring.  Or -1
-	for (int f=0; f < files.count; ++f) if (substringEquals(files.dict[f].key, txt, cursors)) return f;
+	for (int f=0; f < grain->files.count; ++f) if (substringEquals(grain->files.dict[f].key, txt, cursors)) return f;
 	return NOT_FOUND;
 }
 
-int findFieldIter(char *txt, int *cursors){
+int findFieldIter(char *txt, long *cursors){
 	// Returns index of field in fieldDict where key matches txt substring.  Or -1
-	for (int s=0; s < fields.count; ++s) if (substringEquals(fields.dict[s].key, txt, cursors)) return s;
+	for (int s=0; s < grain->fields.count; ++s) if (substringEquals(grain->fields.dict[s].key, txt, cursors)) return s;
 	return NOT_FOUND;
 }
 
-int substringIsNum(char *txt, int from, int to){
+int substringIsNum(char *txt, long from, long to){
 	for (int decimalCount=0  ; from < to; ++from) {
 		if ( (decimalCount += (txt[from]==46)) > 1
 		   || txt[from] != 46 && txt[from] < 48
@@ -316,147 +615,749 @@ int stringIsNum(char *txt){
 	return TRUE;
 }
 
-float substring2Num(char *txt, int *cursors){
-	// Converts txt[START-STOP] to float
-	float result = 0;
-	int pos, isNeg=(txt[cursors[START]]=='-');
-	for (pos=cursors[START] + isNeg; pos < cursors[STOP] && txt[pos] != '.'; ++pos){
-		result *= 10;
-		if (txt[pos] < 48 || txt[pos] > 57) throwError(NOT_NUM, txt, cursors[START], cursors[STOP]);
-		else result += (float)(txt[pos] - 48);
-	}
+int isNumber(char *txt, long from, long to){
+	// TRUE if parseNumber() reads txt[from-to] without raising an error
+	return substringIsNum(txt, from + (from < to && txt[from] == '-'), to);
+}
 
-	if (txt[pos] == '.'){
-		++pos;
-		for (int shift = 10; pos < cursors[STOP]; shift *= 10, ++pos){
-			if (txt[pos] < 48 || txt[pos] > 57) throwError(NOT_NUM, txt, cursors[START], cursors[STOP]);
-			else result += (float)(txt[pos]-48) / (float)shift;
+double powersOf10[]= {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19};
+
+struct number parseNumber(char *txt, long from, long to, long errA, long errB){
+	// Converts txt[from-to] to a number.  errA and errB are passed to throwError if it is not a number.
+	// Whole numbers that fit in 64 bits are held exactly.  Otherwise digits are gathered in one 64 bit integer and scaled
+	// by a single division, which is correctly rounded for up to 15 significant digits.  Longer numbers go to strtod().
+	struct number num = {FALSE, 0, 0};
+	unsigned long long mantissa = 0;
+	long pos = from;
+	int isNeg = (pos < to && txt[pos] == '-'), digits = 0, places = 0, point = FALSE;
+	for (pos += isNeg; pos < to; ++pos){
+		unsigned digit = txt[pos] - 48;
+		if (digit > 9){
+			if (txt[pos] != '.' || point) throwError(NOT_NUM, txt, errA, errB);
+			point = TRUE;
+			continue;
 		}
+		if (digits < 19) mantissa = mantissa * 10 + digit, places += point;
+		digits += (mantissa != 0);
 	}
-	return isNeg ? 0 - result : result;
-}
 
-float string2Num(char *txt){
-	// Converts txt to float
-	float result=0;
-	int pos, isNeg=(txt[0]=='-');
-	for (pos=isNeg; txt[pos] != 0 && txt[pos] != '.'; ++pos){
-		result *= 10;
-		if (txt[pos] < 48 || txt[pos] > 57) throwError(NOT_NUM, txt, -1, -1);
-		else result += (float)(txt[pos] - 48);
+	if (!point && digits <= 19 && mantissa <= (unsigned long long)LLONG_MAX + isNeg){
+		num.isWhole = TRUE;
+		num.whole = isNeg && mantissa ? -(long long)(mantissa - 1) - 1 : (long long)mantissa;
+		num.real = (double)num.whole;
+		return num;
 	}
-
-	if (txt[pos] == '.'){
-		++pos;
-		for (int shift = 10; txt[pos] != 0; shift *= 10, ++pos){
-			if (txt[pos] < 48 || txt[pos] > 57) throwError(NOT_NUM, txt, -1, -1);
-			else result += (float)(txt[pos]-48) / (float)shift;
-			//result += (float)(txt[pos]-48) / (float)shift;
-		}
+	else if (digits <= 19 && (places == 0 || places < 20 && mantissa <= 1ULL << 53)) num.real = places ? (double)mantissa / powersOf10[places] : (double)mantissa;
+	else {
+		// strtod() needs txt terminated at to, so borrow that byte
+		char save = txt[to];
+		if (save) txt[to] = 0;
+		num.real = strtod(&txt[from + isNeg], NULL);
+		if (save) txt[to] = save;
 	}
+	if (isNeg) num.real = 0 - num.real;
+	return num;
+}
+
+struct number substring2Number(char *txt, long *cursors){
+	return parseNumber(txt, cursors[START], cursors[STOP], cursors[START], cursors[STOP]);
+}
 
-	return isNeg ? 0 - result : result;
+struct number string2Number(char *txt){
+	return parseNumber(txt, 0, strlen(txt), -1, -1);
 }
 
-int skipWhitespace(char *txt, int from){
+double substring2Num(char *txt, long *cursors){
+	// Converts txt[START-STOP] to double
+	return substring2Number(txt, cursors).real;
+}
+
+double string2Num(char *txt){
+	// Converts txt to double
+	return string2Number(txt).real;
+}
+
+long skipWhitespace(char *txt, long from){
 	while (txt[++from] == ' ' || txt[from] == '\t' || txt[from] == '\n');
 	return from;
 }
 
-int getNextField(char *txt, char *delimiter, int start, int stop){
+long getNextField(char *txt, char *delimiter, long start, long stop){
 	// Returns delimiter starting position in txt[start-stop]
 	if (delimiter == NULL){ // delimiter == whitespace
 		while (txt[start] != ' ' && txt[start] != '\t' && txt[start] != '\n' && start < stop) ++start  ;
 		return start >= stop ? NOT_FOUND : start;
 	}
-	else for (int i=start, j; i < stop; ++i){
+	else for (long i=start; i < stop; ++i){
+		int j;
 		for (j=0; delimiter[j] != 0 && txt[i+j] == delimiter[j]; ++j);
 		if (delimiter[j] == 0) return i + (delimiter[0] == 0);
 	}
 	return NOT_FOUND;
 }
 
-int skipFields(char *txt, struct fieldDict *field, int index, int from, int to){
+long skipFields(char *txt, struct fieldDict *field, int index, long from, long to){
 	// Load field position after skipping "index" number of fields
 	while (index-- && (from = getNextField(txt, field->val, from, to)) != -1) from = (field->val == NULL ? skipWhitespace(txt, from) : from + field->len) ;
 	return from;
 }
 
-char *loadFile(char *buff, struct fileDict file, int *length, int index){
-	// Skip "index" number of "file" records and load next into "buff"
-	// Saves buff length into *length
+char *stringJoin(char *dest, char *src);
+long countByte(char *txt, char c, long start, long stop){
+	// Count occurrences of c in txt[start-stop], eight bytes at a time
+	// XOR sets matching bytes to zero.  Each zero byte then sets its high bit, which are summed with popcount.
+	unsigned long long pattern = 0x0101010101010101ULL * (unsigned char)c, high = 0x8080808080808080ULL, word;
+	long count = 0;
+	for ( ; start + 8 <= stop; start += 8){
+		memcpy(&word, &txt[start], 8);
+		word ^= pattern;
+		count += __builtin_popcountll(~(((word & ~high) + ~high) | word) & high);
+	}
+	for ( ; start < stop; ++start) count += (txt[start] == c);
+	return count;
+}
 
-	int buffCap=0, cursor, found, in;
-	for (int ind = index+1; ind; buffCap=0, --ind){
-		do {
-			cursor = buffCap;
-			buffCap += READ_SIZE;
-			buff = realloc(buff, (buffCap+1) * sizeof(char));
-			in = fread(&buff[cursor], sizeof(char), READ_SIZE, file.fp);
-			found = getNextField(buff, file.delimiter, cursor, cursor + in);
-		} while (found == NOT_FOUND  &&  in == READ_SIZE);
+long countDelimiter(char *txt, char *delimiter, int len, long start, long stop, long *last){
+	// Count non-overlapping occurrences of delimiter lying entirely within txt[start-stop]
+	// If last != NULL, saves position after the final occurrence there, or NOT_FOUND
+	long count = 0, at = NOT_FOUND;
+	if (delimiter == NULL){ // delimiter == whitespace.  Count each run once.
+		int inRun = FALSE;
+		for (long pos=start; pos < stop; ++pos){
+			int isSpace = (txt[pos] == ' ' || txt[pos] == '\t' || txt[pos] == '\n');
+			if (isSpace && !inRun) ++count;
+			inRun = isSpace;
+		}
+	}
+	else if (len == 0){ // delimiter == char-by-char
+		count = stop > start ? stop - start : 0;
+		at = stop;
+	}
+	else if (len == 1){
+		count = countByte(txt, delimiter[0], start, stop);
+		if (count) for (at = stop; txt[at-1] != delimiter[0]; --at);
+	}
+	else for (char *pos = &txt[start], *end = &txt[stop - len + 1]; pos < end && (pos = memchr(pos, delimiter[0], end - pos)) != NULL; ){
+		if (memcmp(pos, delimiter, len) == 0) ++count, pos += len, at = pos - txt;
+		else ++pos;
+	}
+	if (last != NULL) *last = at;
+	return count;
+}
+
+long fileTell(struct fileDict *file);
+void writeJSON(FILE *out, char *txt){
+	// Write txt as a JSON string
+	fputc('"', out);
+	for ( ; txt != NULL && *txt; ++txt){
+		if (*txt == '"' || *txt == '\\') fprintf(out, "\\%c", *txt);
+		else if ((unsigned char)*txt < ' ') fprintf(out, "\\u%04x", *txt);
+		else fputc(*txt, out);
+	}
+	fputc('"', out);
+}
+
+double now(){
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void reportMetrics(int final){
+	// Periodically report progress of each file iterator.  On the final call, write a JSON summary instead.
+	if (grain->metrics == NULL) return;
+	double elapsed = now() - grain->metricsStart;
+	if (!final && elapsed - grain->metricsLast < grain->metricsInterval) return;
+	grain->metricsLast = elapsed;
+
+	if (final) fprintf(grain->metrics, "{\"elapsed\": %.3f, \"files\": [", elapsed);
+	for (int addr=0; addr < grain->files.count; ++addr){
+		struct fileDict *file = &grain->files.dict[addr];
+		struct fileMetrics *metrics = &file->metrics;
+		long offset = file->fp == NULL ? -1 : fileTell(file);
+		double rate = elapsed > 0 ? metrics->records / elapsed : 0, speed = elapsed > 0 ? metrics->bytes / elapsed : 0;
+		if (final){
+			fprintf(grain->metrics, "%s{\"file\": ", addr ? ", " : "");
+			writeJSON(grain->metrics, file->key);
+			fprintf(grain->metrics, ", \"path\": ");
+			writeJSON(grain->metrics, file->name);
+			fprintf(grain->metrics, ", \"opens\": %i, \"bytes\": %ld, \"offset\": %ld, \"size\": %ld, \"records\": %ld, \"records_per_second\": %.1f, \"bytes_per_record\": %.1f, \"refills\": %ld, \"seeks\": %ld, \"grows\": %ld}",
+				metrics->opens, metrics->bytes, offset, metrics->size, metrics->records, rate, metrics->records ? (double)metrics->bytes / metrics->records : 0, metrics->refills, metrics->seeks, metrics->grows);
+		}
+		else {
+			fprintf(grain->metrics, "grain: %.0fs %s: %ld bytes, %ld records (%.0f/s), refills %ld, seeks %ld, grows %ld", elapsed, file->key, metrics->bytes, metrics->records, rate, metrics->refills, metrics->seeks, metrics->grows);
+			if (metrics->size > 0 && offset >= 0){
+				fprintf(grain->metrics, ", at %ld of %ld (%.1f%%)", offset, metrics->size, 100.0 * offset / metrics->size);
+				if (speed > 0) fprintf(grain->metrics, ", ETA %.0fs", (metrics->size - offset) / speed);
+			}
+			fputc('\n', grain->metrics);
+		}
+	}
+	if (final) fprintf(grain->metrics, "]}\n");
+	fflush(grain->metrics);
+}
+
+long fileTell(struct fileDict *file){
+	// Offset of the next unread record, allowing for bytes already read into the batch
+	return ftell(file->fp) - (file->batchLen - file->batchPos);
+}
+
+void fileSeek(struct fileDict *file, long offset){
+	// Move to offset, discarding the batch
+	file->batchLen = file->batchPos = 0;
+	++file->metrics.seeks;
+	fseek(file->fp, offset, SEEK_SET);
+}
+
+long fillBatch(struct fileDict *file){
+	// Move unread bytes to the front of the batch, then read as many more as fit.  Batch grows if a record fills it.
+	// Returns number of bytes read, 0 at EOF
+	long unread = file->batchLen - file->batchPos;
+	if (file->batchPos > 0) memmove(file->batch, &file->batch[file->batchPos], unread);
+	else if (unread == file->batchCap){
+		long cap = file->batchCap ? 2 * file->batchCap : BATCH_SIZE;
+		char *batch = realloc(file->batch, (cap + 1) * sizeof(char));
+		if (batch == NULL) throwError(TOO_BIG, file->key, -1, -1);
+		if (file->batchCap) ++file->metrics.grows;
+		file->batch = batch, file->batchCap = cap;
+	}
+	file->batchPos = 0;
+	long in = fread(&file->batch[unread], sizeof(char), file->batchCap - unread, file->fp);
+	file->batchLen = unread + in;
+	file->batch[file->batchLen] = 0;
+	++file->metrics.refills;
+	file->metrics.bytes += in;
+	reportMetrics(FALSE);
+	return in;
+}
+
+void saveCheckpoint(struct fileDict *file){
+	// Save offset of the next unread record.  Written to a temporary file first so a crash cannot leave it half written.
+	char *temp = stringJoin(stringSave(NULL, file->checkpoint), ".tmp");
+	FILE *fp = fopen(temp, "w");
+	if (fp != NULL){
+		fprintf(fp, "%ld\n", fileTell(file));
+		fclose(fp);
+		rename(temp, file->checkpoint);
+	}
+	free(temp);
+}
+
+void loadCheckpoint(struct fileDict *file){
+	// Resume from saved offset, unless the file has since shrunk (truncated or rotated)
+	long offset, size;
+	FILE *fp = fopen(file->checkpoint, "r");
+	if (fp == NULL) return;
+	if (fscanf(fp, "%ld", &offset) == 1){
+		long current = fileTell(file);
+		++file->metrics.seeks;
+		fseek(file->fp, 0, SEEK_END);
+		size = ftell(file->fp);
+		fileSeek(file, offset <= size ? offset : current);
+	}
+	fclose(fp);
+}
 
-		if (found != NOT_FOUND) fseek(file.fp, (long)(0 - (feof(file.fp) ? in : buffCap) + found + file.len), SEEK_CUR);
-		if (feof(file.fp) && ind > 1) throwError(OOR, file.key, index, -1);
+char *readRest(struct fileDict *file, long *length){
+	// Read the rest of the file into a new buffer, saving its length into *length
+	// Seekable files are sized first and read in one go.  Pipes cannot be sized, so they are read in doubling blocks.
+	char *rest = NULL;
+	long origin = ftell(file->fp), size = BATCH_SIZE, got = 0;
+	if (origin >= 0 && fseek(file->fp, 0, SEEK_END) == 0){
+		size = ftell(file->fp) - origin + 1;	// one extra byte to reach EOF
+		fseek(file->fp, origin, SEEK_SET);
+		file->metrics.seeks += 2;
 	}
+	int slot = own(NULL);
+	for ( ; ; size *= 2){
+		char *grown = realloc(rest, (size + 1) * sizeof(char));
+		if (grown == NULL) throwError(TOO_BIG, file->key, -1, -1);
+		if (rest != NULL) ++file->metrics.grows;
+		reown(slot, rest = grown);
+		long in = fread(&rest[got], sizeof(char), size - got, file->fp);
+		file->metrics.bytes += in;
+		reportMetrics(FALSE);
+		if ((got += in) < size) break;
+	}
+	disown(slot);
+	*length = got;
+	rest[got] = 0;
+	return rest;
+}
 
-	*length = (found == NOT_FOUND ? cursor + in : found);
+int terminateRecord(char *record, long at){
+	// Write the 0 byte ending a mapped record.  Only its page is made writable: a private mapping that is writable
+	// throughout is charged against memory as though every page could be copied.  Returns FALSE if it cannot be written
+	long page = sysconf(_SC_PAGESIZE);
+	if (mprotect((char *)((unsigned long)&record[at] / page * page), page, PROT_READ | PROT_WRITE) != 0) return FALSE;
+	record[at] = 0;
+	return TRUE;
+}
 
-	if (feof(file.fp) && *length==0){
-		free(buff);
+char *mapRecord(struct fileDict *file, long origin, long *length){
+	// Map the rest of the file from origin, terminated by a 0 byte, saving its length into *length
+	// Pages are only read as the record is scanned, and can be dropped again, so a record need not fit in memory
+	// Returns NULL, for the record to be read instead, if fewer than MAP_SIZE bytes remain, the file is a stream or
+	// followed (and so may be truncated while mapped), or the mapping fails
+	struct stat info;
+	if (!file->mappable || file->checkpoint != NULL || fstat(fileno(file->fp), &info) != 0 || info.st_size - origin < MAP_SIZE) return NULL;
+
+	// The file is mapped over an anonymous area one byte longer, so the terminator has a page even if the file fills its last
+	long page = sysconf(_SC_PAGESIZE), base = origin / page * page;
+	size_t size = info.st_size - base + 1;
+	char *area = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED) return NULL;
+	if (mmap(area, size - 1, PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(file->fp), base) == MAP_FAILED || !terminateRecord(area, size - 1)){
+		munmap(area, size);
 		return NULL;
 	}
+	madvise(area, size, MADV_SEQUENTIAL);
+
+	struct mappedRecords *mapped = &grain->mapped;
+	if (mapped->count == mapped->cap) mapped->list = realloc(mapped->list, (mapped->cap = mapped->cap ? mapped->cap * 2 : 4) * sizeof(struct mapped));
+	mapped->list[mapped->count++] = (struct mapped){&area[origin - base], area, size};
+	*length = info.st_size - origin;
+	return &area[origin - base];
+}
+
+char *loadFile(char *buff, struct fileDict *file, long *length, int index){
+	// Skip "index" number of "file" records and load next into "buff"
+	// Records are cut from the batch, which is refilled in large blocks, so there is no fread() or fseek() per record
+	// A record outgrowing MAP_SIZE is mapped from the file instead, as is a whole file of that size
+	// Saves buff length into *length
+	long found, next;
+	for (int ind = index+1; ind; --ind){
+		// Records starting at or beyond the end of the byte range belong to the next shard
+		long origin = fileTell(file);
+		if (file->to != NO_LIMIT && origin >= file->to){
+			if (ind > 1) throwError(OOR, file->key, index, -1);
+			freeRecord(buff);
+			return NULL;
+		}
+
+		if (file->whole){
+			char *rest = mapRecord(file, origin, length);
+			if (rest != NULL) fileSeek(file, origin + *length), file->metrics.bytes += *length;
+			else rest = readRest(file, length);
+			if (*length == 0){
+				free(rest);
+				if (ind > 1) throwError(OOR, file->key, index, -1);
+				freeRecord(buff);
+				return NULL;
+			}
+			freeRecord(buff);
+			buff = rest;
+			file->origin = origin;
+			++file->metrics.records;
+			reportMetrics(FALSE);
+			continue;
+		}
+
+		// Search batch for delimiter, refilling until found or EOF.  Rescan the tail in case the delimiter straddles a refill.
+		char *mapped = NULL;
+		long unread = 0, size;
+		for (long from = file->batchPos; (found = getNextField(file->batch, file->delimiter, from, file->batchLen)) == NOT_FOUND; ){
+			unread = file->batchLen - file->batchPos;
+			from = unread > file->len ? unread - file->len + 1 : 0;
+			// Rather than grow the batch past MAP_SIZE, carry on the search in a mapping starting at the record
+			if (unread >= MAP_SIZE && (mapped = mapRecord(file, origin, &size)) != NULL){
+				found = getNextField(mapped, file->delimiter, from, size);
+				break;
+			}
+			if (fillBatch(file) == 0) break;
+		}
+
+		if (mapped != NULL){
+			// A final record without a delimiter runs to the end of the file
+			if (found == NOT_FOUND) found = next = size;
+			else next = found + file->len;
+			file->metrics.bytes += next - unread;
+			fileSeek(file, origin + next);
+			if (ind > 1) freeRecord(mapped);
+			else {
+				if (!terminateRecord(mapped, found)) freeRecord(mapped), throwError(TOO_BIG, file->key, -1, -1);
+				++file->metrics.records;
+				file->origin = origin;
+				*length = found;
+				freeRecord(buff);
+				buff = mapped;
+			}
+			continue;
+		}
+		else if (found != NOT_FOUND) next = found + file->len;
+		else if (file->checkpoint != NULL && file->wait){
+			// Following: wait for the final record to be completed
+			saveCheckpoint(file);
+			sleep(file->wait);
+			clearerr(file->fp);
+			++ind;
+			continue;
+		}
+		else if (file->batchPos == file->batchLen || file->checkpoint != NULL){
+			// End of file.  If following, leave the incomplete final record to be read once its delimiter arrives.
+			if (ind > 1) throwError(OOR, file->key, index, -1);
+			freeRecord(buff);
+			return NULL;
+		}
+		else found = next = file->batchLen;
+
+		if (ind == 1){
+			++file->metrics.records;
+			file->origin = origin;
+			*length = found - file->batchPos;
+			if (buff != NULL && *length > file->metrics.longest) ++file->metrics.grows;
+			if (*length > file->metrics.longest) file->metrics.longest = *length;
+			// A mapped buffer is only released once its replacement is allocated, so a failure leaves it with its owner
+			int wasMapped = mappedSlot(buff) != NOT_FOUND;
+			char *record = realloc(wasMapped ? NULL : buff, (*length + 1) * sizeof(char));
+			if (record == NULL) throwError(TOO_BIG, file->key, -1, -1);
+			if (wasMapped) freeRecord(buff);
+			buff = record;
+			memcpy(buff, &file->batch[file->batchPos], *length);
+			buff[*length] = 0;
+		}
+		file->batchPos = next;
+	}
+	return buff;
+}
+
+void seekRange(struct fileDict *file){
+	// Move file cursor to the first record starting at or after file->from
+	// The record straddling file->from belongs to the previous range, so discard it
+	long length;
+	if (file->from <= 0) return;
+	else if (file->whole) ++file->metrics.seeks, fseek(file->fp, 0, SEEK_END);
+	else if (file->len == 0) fileSeek(file, file->from);
 	else {
-		buff[*length] = 0;
-		return realloc(buff, (1 + *length) * sizeof(char));
+		fileSeek(file, file->from >= file->len ? file->from - file->len : 0);
+		freeRecord(loadFile(NULL, file, &length, 0));
+	}
+}
+
+long occursFile(struct fileDict *file){
+	// Count delimiters terminating the remaining records, scanning large blocks instead of loading each record
+	// Leaves the file cursor after the last counted delimiter, so any incomplete final record is still unread
+	int keep = 0, in;
+	long count = 0, last, offset = fileTell(file), end = offset;
+	if (file->whole || file->to != NO_LIMIT && offset >= file->to) return 0;
+	else if (file->len == 0){ // delimiter == char-by-char
+		++file->metrics.seeks;
+		fseek(file->fp, 0, SEEK_END);
+		end = ftell(file->fp);
+		if (file->to != NO_LIMIT && end > file->to) end = file->to;
+		fileSeek(file, end);
+		return end - offset;
+	}
+
+	fileSeek(file, offset);
+	char *block = malloc((SCAN_SIZE + file->len + 1) * sizeof(char));
+	while ((in = fread(&block[keep], sizeof(char), SCAN_SIZE, file->fp)) > 0){
+		int avail = keep + in, cut = avail, from;
+		file->metrics.bytes += in;
+		reportMetrics(FALSE);
+		block[avail] = 0;
+
+		// Delimiters ending before the range stop are all counted
+		if (file->to != NO_LIMIT && offset + avail >= file->to) cut = file->to - 1 - offset > 0 ? file->to - 1 - offset : 0;
+		count += countDelimiter(block, file->delimiter, file->len, 0, cut, &last);
+		if (last != NOT_FOUND) end = offset + last;
+
+		// After that, only the delimiter closing the final record in range
+		if (cut < avail){
+			from = cut - file->len + 1 > end - offset ? cut - file->len + 1 : end - offset;
+			if ((last = getNextField(block, file->delimiter, from > 0 ? from : 0, avail - file->len + 1)) != NOT_FOUND){
+				++count;
+				end = offset + last + file->len;
+				break;
+			}
+		}
+
+		// Carry over bytes that could begin a delimiter straddling the block boundary
+		int carry = avail - file->len + 1 > end - offset ? avail - file->len + 1 : end - offset;
+		if (carry < 0) carry = 0;
+		memmove(block, &block[carry], avail - carry);
+		keep = avail - carry;
+		offset += carry;
+	}
+	free(block);
+	fileSeek(file, end);
+	return count;
+}
+
+void freeSidecar(struct fileDict *file){
+	if (file->cache == NULL) return;
+	munmap(file->cache->map, file->cache->size);
+	free(file->cache);
+	file->cache = NULL;
+}
+
+int mapSidecar(struct fileDict *file, int addr, char *path, struct stat *info){
+	// Map sidecar into file->cache if it matches the file's size, mtime and delimiters
+	// Returns TRUE if successful
+	struct fieldDict *field = &grain->fields.dict[addr];
+	struct sidecarHeader *head;
+	struct stat sideInfo;
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) return FALSE;
+	fstat(fileno(fp), &sideInfo);
+	void *map = sideInfo.st_size >= sizeof(struct sidecarHeader) ? mmap(NULL, sideInfo.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0) : MAP_FAILED;
+	fclose(fp);
+	if (map == MAP_FAILED) return FALSE;
+
+	// Check the header alone, then that the file is exactly the size it describes, before reading anything beyond it
+	head = map;
+	char *delims = (char *)map + sizeof(struct sidecarHeader);
+	int fieldLen = field->val == NULL ? -1 : field->len, padded = (file->len + (fieldLen > 0 ? fieldLen : 0) + 7) / 8 * 8;
+	if (memcmp(head->magic, "GRNC", 4) != 0 || head->version != SIDECAR_VERSION
+	   || head->size != info->st_size || head->mtime != info->st_mtime
+	   || head->fileLen != file->len || head->fieldLen != fieldLen
+	   || head->records < 0 || head->records > sideInfo.st_size || head->starts < 0 || head->starts > sideInfo.st_size
+	   || sideInfo.st_size != sizeof(struct sidecarHeader) + padded + head->records * sizeof(long) * 2 + sizeof(long) + head->starts * sizeof(int)
+	   || memcmp(delims, file->delimiter, file->len) != 0
+	   || fieldLen > 0 && memcmp(&delims[file->len], field->val, fieldLen) != 0
+	   || ((long *)&delims[padded])[2 * head->records] != head->starts){
+		munmap(map, sideInfo.st_size);
+		return FALSE;
+	}
+
+	file->cache = malloc(sizeof(struct sidecar));
+	file->cache->field = addr;
+	file->cache->records = head->records;
+	file->cache->next = 0;
+	file->cache->offsets = (long *)&delims[padded];
+	file->cache->first = &file->cache->offsets[head->records];
+	file->cache->starts = (int *)&file->cache->first[head->records + 1];
+	file->cache->map = map;
+	file->cache->size = sideInfo.st_size;
+	return TRUE;
+}
+
+void writeSidecar(struct fileDict *file, int addr, char *path, struct stat *info){
+	// Scan whole file once, saving each record's offset and the start of each of its fields
+	struct fieldDict *field = &grain->fields.dict[addr];
+	// The scan is kept in the context, and the arrays registered with it, in case loadFile() throws part way
+	struct fileDict *scan = &grain->scan;
+	scan->key = file->key, scan->delimiter = file->delimiter, scan->len = file->len, scan->whole = file->whole, scan->mappable = file->mappable, scan->to = NO_LIMIT;
+	if ((scan->fp = fopen(file->name, "r")) == NULL) return;
+
+	long records = 0, count = 0, recordCap = 0, startCap = 0, *offsets = NULL, *first = NULL;
+	int *starts = NULL, slots[] = {own(NULL), own(NULL), own(NULL), own(NULL)};
+	long length;
+	char *buff = NULL;
+	while ((buff = loadFile(buff, scan, &length, 0)) != NULL){
+		reown(slots[0], buff);
+		// Field starts are saved as ints, so a file holding a record of 2GB or more is not cached
+		if (length > INT_MAX) break;
+		if (records + 1 >= recordCap){
+			recordCap = recordCap ? recordCap * 2 : 1024;
+			reown(slots[1], offsets = realloc(offsets, recordCap * sizeof(long)));
+			reown(slots[2], first = realloc(first, recordCap * sizeof(long)));
+		}
+		offsets[records] = scan->origin;
+		first[records++] = count;
+		for (long from = 0; from != NOT_FOUND; from = skipFields(buff, field, 1, from, length)){
+			if (count == startCap) reown(slots[3], starts = realloc(starts, (startCap = startCap ? startCap * 2 : 1024) * sizeof(int)));
+			starts[count++] = from;
+		}
+	}
+	int tooLong = buff != NULL;
+	freeRecord(buff);
+	if (first != NULL) first[records] = count;
+	fclose(scan->fp);
+	free(scan->batch);
+	*scan = (struct fileDict){0};
+	for (int slot = 3; slot >= 0; --slot) disown(slots[slot]);
+
+	struct sidecarHeader head = {{'G', 'R', 'N', 'C'}, SIDECAR_VERSION, info->st_size, info->st_mtime, file->len, field->val == NULL ? -1 : field->len, records, count};
+	char padding[8] = {0};
+	int delimLen = file->len + (field->val == NULL ? 0 : field->len);
+
+	// Written to a temporary file first, so a reader never maps a half written sidecar
+	char *temp = stringJoin(stringSave(NULL, path), ".tmp");
+	FILE *fp = tooLong ? NULL : fopen(temp, "w");
+	if (fp != NULL){
+		fwrite(&head, sizeof(head), 1, fp);
+		fwrite(file->delimiter, sizeof(char), file->len, fp);
+		if (field->val != NULL) fwrite(field->val, sizeof(char), field->len, fp);
+		fwrite(padding, sizeof(char), (delimLen + 7) / 8 * 8 - delimLen, fp);
+		if (records){
+			fwrite(offsets, sizeof(long), records, fp);
+			fwrite(first, sizeof(long), records + 1, fp);
+			fwrite(starts, sizeof(int), count, fp);
+		}
+		else fwrite(&count, sizeof(long), 1, fp);
+		int failed = ferror(fp);
+		if (fclose(fp) == 0 && !failed) rename(temp, path);
+		else remove(temp);
+	}
+	free(temp);
+	free(offsets), free(first), free(starts);
+}
+
+long skipCached(struct fileDict *file, long origin, char *txt, int addr, int index, long from, long to){
+	// skipFields(), but jump straight to the field if file's sidecar holds this record
+	struct sidecar *cache = file == NULL ? NULL : file->cache;
+	if (cache != NULL && cache->field == addr && from == 0 && index >= 0){
+		// Records are usually visited in order, so try the next one before searching
+		long lo = 0, hi = cache->records - 1, r = cache->next;
+		if (r >= cache->records || cache->offsets[r] != origin) while (lo <= hi){
+			r = (lo + hi) / 2;
+			if (cache->offsets[r] == origin) break;
+			else if (cache->offsets[r] < origin) lo = r + 1;
+			else hi = r - 1;
+		}
+		if (r < cache->records && cache->offsets[r] == origin){
+			cache->next = r + 1;
+			return index < cache->first[r+1] - cache->first[r] ? cache->starts[cache->first[r] + index] : NOT_FOUND;
+		}
 	}
+	return skipFields(txt, &grain->fields.dict[addr], index, from, to);
 }
 
-void printSubstring(char *txt, int start, int stop){
-	// Temporarily null terminate substring for printing
-	char swap = txt[stop];
-	txt[stop] = 0;
-	printf("%s", &txt[start]);
-	txt[stop] = swap;
+void printSubstring(char *txt, long start, long stop){
+	// Send txt[start-stop] to the context's output, or stdout.  The output callback takes an int length, so longer
+	// spans are sent in pieces
+	for (long piece; start < stop; start += piece){
+		piece = stop - start < INT_MAX ? stop - start : INT_MAX;
+		if (grain->output != NULL) grain->output(grain->outputUser, &txt[start], piece);
+		else fwrite(&txt[start], sizeof(char), piece, stdout);
+	}
 }
 
-float token2Num(char *txt, int *cursors){
+double token2Num(char *txt, long *cursors){
 	// Convert token to integer.  Either variable or string number.
-	return txt[cursors[START]] >= 48 && txt[cursors[START]] <= 57 ? substring2Num(txt, cursors) : string2Num(vars.dict[findVar(txt, cursors)].val);
+	return txt[cursors[START]] >= 48 && txt[cursors[START]] <= 57 ? substring2Num(txt, cursors) : string2Num(grain->vars.dict[findVar(txt, cursors)].val);
+}
+
+long token2Long(char *txt, long *cursors){
+	// Convert token to a whole number without float rounding.  Either variable or string number.
+	long from = cursors[START], to = cursors[STOP];
+	if (txt[from] < 48 || txt[from] > 57){
+		txt = grain->vars.dict[findVar(txt, cursors)].val;
+		for (from = 0, to = 0; txt[to] != 0; ++to);
+	}
+
+	long result = 0;
+	for (long pos = from; pos < to; ++pos){
+		if (txt[pos] < 48 || txt[pos] > 57) throwError(NOT_NUM, txt, from, to);
+		result = result * 10 + (txt[pos] - 48);
+	}
+	return result;
+}
+
+int formatNum(char *txt, double num){
+	// Write num into txt, which must hold NUM_SIZE characters.  Returns length
+	// Rounded to five decimal places in a 64 bit integer.  Huge numbers, and any too close to a rounding tie for that
+	// to be certain, are left to snprintf()
+	int isNeg = (num < 0), length;
+	double scaled = (isNeg ? 0 - num : num) * 100000;
+	if (scaled < 9e18){
+		unsigned long long rounded = (unsigned long long)scaled;
+		double tie = scaled - rounded - 0.5, error = scaled * 2.3e-16;
+		if (tie > error || tie < 0 - error){
+			char buff[32], *pos = &buff[sizeof(buff)];
+			rounded += (tie > 0);
+			unsigned long long whole = rounded / 100000;
+			int lower = rounded % 100000, places = 5;
+			if (lower){
+				for ( ; lower % 10 == 0; lower /= 10, --places);
+				for ( ; places; lower /= 10, --places) *--pos = (lower % 10) + 48;
+				*--pos = '.';
+			}
+			do *--pos = (whole % 10) + 48; while (whole /= 10);
+			if (isNeg && rounded) *--pos = '-';
+			length = &buff[sizeof(buff)] - pos;
+			memcpy(txt, pos, length);
+			txt[length] = 0;
+			return length;
+		}
+	}
+
+	if (num > -1e100 && num < 1e100){
+		length = snprintf(txt, NUM_SIZE, "%.5f", num);
+		while (txt[length - 1] == '0') --length;
+		if (txt[length - 1] == '.') --length;
+		txt[length] = 0;
+		if (strcmp(txt, "-0") == 0) length = 1, memmove(txt, "0", 2);
+		return length;
+	}
+	return snprintf(txt, NUM_SIZE, "%g", num);
 }
 
-char *num2String(char *txt, float num){
-	int isNeg = (num < 0);
-	if (isNeg) num *= -1;
-	int upper = (int)num, upperDigits = 0, lowerDigits = 0;
-	float lower = num - upper;
+int formatNumber(char *txt, struct number num){
+	// formatNum(), but whole numbers are written exactly
+	if (!num.isWhole) return formatNum(txt, num.real);
+	char buff[32], *pos = &buff[sizeof(buff)];
+	unsigned long long whole = num.whole < 0 ? 0 - (unsigned long long)num.whole : (unsigned long long)num.whole;
+	do *--pos = (whole % 10) + 48; while (whole /= 10);
+	if (num.whole < 0) *--pos = '-';
+	int length = &buff[sizeof(buff)] - pos;
+	memcpy(txt, pos, length);
+	txt[length] = 0;
+	return length;
+}
 
-	for (int cpy=upper; cpy ; cpy/=10, ++upperDigits);
-	while ( (lower - (int)lower) > 0.0000000000000001f) lower*=10, ++lowerDigits;
+int wholeOf(struct number num, long long *whole){
+	// Save num without its fraction into *whole.  Returns FALSE if it does not fit in 64 bits
+	if (num.isWhole) *whole = num.whole;
+	else if (num.real > -9.2e18 && num.real < 9.2e18) *whole = (long long)num.real;
+	else return FALSE;
+	return TRUE;
+}
 
-	// total digits: add one for decimal place, one for negative symbol and one if number == 0
-	int totalDigits = upperDigits + lowerDigits + (lowerDigits > 0) + isNeg + (upper == 0);
-	txt = realloc(txt, (totalDigits + 1) * sizeof(char));
-	txt[totalDigits] = 0;
+struct number numberOp(struct number a, char op, struct number b){
+	// a op b, where op is + - * / or %.  Whole numbers stay exact unless the result overflows or has a fraction
+	struct number result = {TRUE, 0, 0};
+	long long x, y;
+	char buff[NUM_SIZE];
+	switch (op){
+	case '+':
+		if (!a.isWhole || !b.isWhole || __builtin_add_overflow(a.whole, b.whole, &result.whole)) result.isWhole = FALSE, result.real = a.real + b.real;
+		break;
+	case '-':
+		if (!a.isWhole || !b.isWhole || __builtin_sub_overflow(a.whole, b.whole, &result.whole)) result.isWhole = FALSE, result.real = a.real - b.real;
+		break;
+	case '*':
+		if (!a.isWhole || !b.isWhole || __builtin_mul_overflow(a.whole, b.whole, &result.whole)) result.isWhole = FALSE, result.real = a.real * b.real;
+		break;
+	case '/':
+		if (a.isWhole && b.isWhole && b.whole != 0 && b.whole != -1 && a.whole % b.whole == 0) result.whole = a.whole / b.whole;
+		else result.isWhole = FALSE, result.real = a.real / b.real;
+		break;
+	case '%':
+		// Fractions are discarded, without rounding
+		if (!wholeOf(a, &x)) formatNumber(buff, a), throwError(MODULO, buff, -1, -1);
+		if (!wholeOf(b, &y) || y == 0) formatNumber(buff, b), throwError(MODULO, buff, -1, -1);
+		result.whole = y == -1 ? 0 : x % y;
+		break;
+	default:
+		return a;
+	}
+	if (result.isWhole) result.real = (double)result.whole;
+	return result;
+}
 
-	for (int cpy = (int)lower, pos = lowerDigits; pos; cpy/=10, --pos) txt[--totalDigits] = (cpy % 10) + 48;
-	if (lowerDigits) txt[--totalDigits] = '.';
+int compareNumbers(struct number a, struct number b){
+	// Return 0 if a == b ; 1 if a > b ; -1 if a < b
+	if (a.isWhole && b.isWhole) return a.whole == b.whole ? 0 : a.whole > b.whole ? 1 : -1;
+	return a.real == b.real ? 0 : a.real > b.real ? 1 : -1;
+}
 
-	if (upper == 0) txt[--totalDigits] = '0';
-	else for (int cpy = upper; cpy ; cpy/=10) txt[--totalDigits] = (cpy % 10) + 48;
-	
-	if (isNeg) txt[--totalDigits] = '-';
-		
+char *num2String(char *txt, struct number num){
+	char buff[NUM_SIZE];
+	int length = formatNumber(buff, num);
+	txt = realloc(txt, (length + 1) * sizeof(char));
+	memcpy(txt, buff, length + 1);
 	return txt;
 }
 
-char *substringJoin(char *dest, char *src, int from, int to){
+char *substringJoin(char *dest, char *src, long from, long to){
 	// Join source[from-to] to end of dest
-	int len = 0;
+	long len = 0;
 	if (dest != NULL) while (dest[len] != 0) ++len;
 	
 	dest = realloc(dest, (len + to - from + 1) * sizeof(char));
-	for (int dPos=len, sPos=from; sPos < to; ++dPos, ++sPos) dest[dPos] = src[sPos];
+	for (long dPos=len, sPos=from; sPos < to; ++dPos, ++sPos) dest[dPos] = src[sPos];
 	dest[len + to - from] = 0;
 	return dest;
 }
@@ -480,203 +1381,419 @@ struct loopStack resetLoop(char *scriptLine, FILE *scriptFile){
 	// Setup loopStruct cursors 
 	// Use resetLoop on the way up the chain, use loadLoop on the way down the chain
 	
-	struct loopStruct *loop = &loops.stack[loops.ptr];
+	struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
 	if (loop->type == FIELD_ITER){
 		// Load FIELD_ITER
-		struct loopStruct *parent = &loops.stack[loops.ptr-1];
+		struct loopStruct *parent = &grain->loops.stack[grain->loops.ptr-1];
 		loop->buff = parent->buff;
 		if (loop->index == NO_INDEX) loop->start = parent->start;
-		else if ( (loop->start = skipFields(loop->buff, &fields.dict[loop->addr], loop->index, parent->start, parent->stop)) == NOT_FOUND)
-			throwError(OOR, fields.dict[loop->addr].key, loop->index, -1);
-		if ( (loop->stop = getNextField(loop->buff, fields.dict[loop->addr].val, loop->start, parent->stop)) == NOT_FOUND)
+		else if ( (loop->start = skipCached(parent->type == FILE_ITER ? &grain->files.dict[parent->addr] : NULL, parent->origin, loop->buff, loop->addr, loop->index, parent->start, parent->stop)) == NOT_FOUND)
+			throwError(OOR, grain->fields.dict[loop->addr].key, loop->index, -1);
+		if ( (loop->stop = getNextField(loop->buff, grain->fields.dict[loop->addr].val, loop->start, parent->stop)) == NOT_FOUND)
 			loop->stop = parent->stop;
 	}
+	else if (loop->type == VAR){
+		// Borrow variable's value without copying
+		loop->buff = grain->vars.dict[loop->addr].val;
+		loop->start = 0, loop->stop = strlen(loop->buff);
+	}
+	else if (loop->type == LITERAL) loop->start = 0, loop->stop = strlen(loop->buff);
 	else {	
 		// Load FILE_ITER
-		loop->buff = loadFile(NULL, files.dict[loop->addr], &loop->stop, loop->index);
-		if (loop->buff == NULL) return --loops.ptr == -1 ? loops : loadLoop(scriptLine, scriptFile);
-		else loop->start = 0;
+		loop->buff = loadFile(NULL, &grain->files.dict[loop->addr], &loop->stop, loop->index);
+		if (loop->buff == NULL) return --grain->loops.ptr == -1 || grain->loops.stack[grain->loops.ptr].chain == FALSE ? grain->loops : loadLoop(scriptLine, scriptFile);
+		else loop->start = 0, loop->origin = grain->files.dict[loop->addr].origin;
 	}
 
 	if (loop->chain == TRUE){
-		++loops.ptr;
+		++grain->loops.ptr;
 		return resetLoop(scriptLine, scriptFile);
 	}
+	else if (scriptFile == NULL) ; // compiled script: C loop handles jump
 	else if (loop->cmd == -1) loop->cmd = ftell(scriptFile);
 	else fseek(scriptFile, loop->cmd, SEEK_SET);
 
-	return loops;
+	return grain->loops;
 }
 
 struct loopStack loadLoop(char *scriptLine, FILE *scriptFile){
 	// Advance loopStruct cursors
 	// Use loadLoop on the way down the chain, use resetLoop on the way up the chain
-	struct loopStruct *loop = &loops.stack[loops.ptr];
-	struct loopStruct *parent = &loops.stack[loops.ptr-1];
+	struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
+	struct loopStruct *parent = &grain->loops.stack[grain->loops.ptr-1];
 
-	if (loop->isLoop == FALSE) 
-		return --loops.ptr == -1 || loops.stack[loops.ptr].chain == FALSE ? loops : loadLoop(scriptLine, scriptFile);
+	if (loop->isLoop == FALSE){
+		if (loop->type == FILE_ITER || loop->type == LITERAL) freeRecord(loop->buff);
+		return --grain->loops.ptr == -1 || grain->loops.stack[grain->loops.ptr].chain == FALSE ? grain->loops : loadLoop(scriptLine, scriptFile);
+	}
 	else if (loop->type == FIELD_ITER){
-		loop->start = (fields.dict[loop->addr].val == NULL ? skipWhitespace(loop->buff, loop->stop) : loop->stop + fields.dict[loop->addr].len);
+		loop->start = (grain->fields.dict[loop->addr].val == NULL ? (loop->stop < parent->stop ? skipWhitespace(loop->buff, loop->stop) : parent->stop + 1) : loop->stop + grain->fields.dict[loop->addr].len);
 					       // delim != whitespace		    && delim == char-by-char	 	 && reached final char
-		if (loop->start > parent->stop || fields.dict[loop->addr].val != NULL && fields.dict[loop->addr].val[0] == 0 && loop->start == parent->stop)
-			return --loops.ptr == -1 || loops.stack[loops.ptr].chain == FALSE ? loops : loadLoop(scriptLine, scriptFile);
-		else if ( (loop->stop = getNextField(loop->buff, fields.dict[loop->addr].val, loop->start, parent->stop)) == NOT_FOUND)
+		if (loop->start > parent->stop || grain->fields.dict[loop->addr].val != NULL && grain->fields.dict[loop->addr].val[0] == 0 && loop->start == parent->stop)
+			return --grain->loops.ptr == -1 || grain->loops.stack[grain->loops.ptr].chain == FALSE ? grain->loops : loadLoop(scriptLine, scriptFile);
+		else if ( (loop->stop = getNextField(loop->buff, grain->fields.dict[loop->addr].val, loop->start, parent->stop)) == NOT_FOUND)
 			loop->stop = parent->stop;
 	}
-	else if ( (loop->buff = loadFile(loop->buff, files.dict[loop->addr], &loop->stop, 0)) == NULL)
-		return --loops.ptr == -1 || loops.stack[loops.ptr].chain == FALSE ? loops : loadLoop(scriptLine, scriptFile);
+	else if ( (loop->buff = loadFile(loop->buff, &grain->files.dict[loop->addr], &loop->stop, 0)) == NULL)
+		return --grain->loops.ptr == -1 || grain->loops.stack[grain->loops.ptr].chain == FALSE ? grain->loops : loadLoop(scriptLine, scriptFile);
+	else loop->origin = grain->files.dict[loop->addr].origin;
 	
 	if (loop->chain == TRUE){
-		++loops.ptr;
+		++grain->loops.ptr;
 		return resetLoop(scriptLine, scriptFile);
 	}
 	else {
-		fseek(scriptFile, loop->cmd, SEEK_SET);
-		return loops;
+		if (scriptFile != NULL) fseek(scriptFile, loop->cmd, SEEK_SET);
+		return grain->loops;
 	}
 }
 
-int retrieveToken(int *outCurs, char **outTxt, char *inTxt, int *inCurs){
-	// Converts next token to value.  Gets token from inTxt[start-stop].  Returns string in outTxt[start-stop]
-	// Token could refer to a variable, file iterator or field iterator.  Could be a number or string quote.
-	// If substring, puts start/stop in outCurs.  Else string, puts STRING (-1) in outCurs[START]
-	// If memory allocated for string, returns TRUE.  Else returns FALSE.
-	// If no token, returns TERMINATOR (-1)
+int findAggregate(char *txt, long *cursors){
+	// Returns aggregate type where name matches txt substring.  Or -1
+	char *names[] = {"sum", "min", "max", "mean", "count", "occurs"};
+	for (int a=SUM; a <= OCCURS; ++a) if (substringEquals(names[a], txt, cursors)) return a;
+	return NOT_FOUND;
+}
 
-	int addr;
-	switch (getNextToken(inTxt, inCurs)){
-	case DOLLAR:
-		// User provided dollar ($), which means "entire buffer"
-		if (inTxt[inCurs[START]] != '$') throwError(NO_DOLLAR, &inTxt[inCurs[START]], -1, -1);
-		else if (loops.ptr == NO_LOOP) throwError(NO_BUFFER, NULL, -1, -1);
-		*outTxt = loops.stack[loops.ptr].buff;
-		if (loops.stack[loops.ptr].type == FIELD_ITER){
-			outCurs[START] = loops.stack[loops.ptr].start;
-			outCurs[STOP] = loops.stack[loops.ptr].stop;
-		}
-		else outCurs[START] = STRING;
-		return FALSE;
-	case NUMBER:
-	case QUOTE:
-		outCurs[START] = inCurs[START];
-		outCurs[STOP] = inCurs[STOP];
-		*outTxt = inTxt;
-		return FALSE;
-	case VARIABLE:
-		if (inTxt[inCurs[STOP]] == '['){ 											// Iterator
-			if ((addr = findFieldIter(inTxt, inCurs)) != NOT_FOUND) { 							// Field iterator
-				if (loops.ptr == NO_LOOP) throwError(NO_FILE_ITER, fields.dict[addr].key, -1, -1);
-				getNextToken(inTxt, inCurs);
-				struct loopStruct *loop = &loops.stack[loops.ptr];
-				outCurs[START] = skipFields(loop->buff, &fields.dict[addr], (int)token2Num(inTxt, inCurs), loop->start, loop->stop);
-				if (outCurs[START] == NOT_FOUND) throwError(OOR, fields.dict[addr].key, (int)token2Num(inTxt, inCurs), FIELD_ITER);
-				outCurs[STOP] = getNextField(loop->buff, fields.dict[addr].val, outCurs[START], loop->stop);
-				if (outCurs[STOP] == NOT_FOUND) outCurs[STOP] = loop->stop;
-				*outTxt = loops.stack[loops.ptr].buff;
-				return FALSE;
-			}
-			else if ((addr = findFileIter(inTxt, inCurs)) != NOT_FOUND){							// File iterator
-				getNextToken(inTxt, inCurs);
-				outCurs[START] = STRING;
-				*outTxt = loadFile(NULL, files.dict[addr], &addr, (int)token2Num(inTxt, inCurs));
-				return TRUE;
-			}
-			else if ((addr = findVar(inTxt, inCurs)) != NOT_FOUND) throwError(INDEX_VAR, vars.dict[addr].key, -1, -1);	// Var error
-			else throwError(NOT_EXIST, inTxt, inCurs[START], inCurs[STOP]);							// Unknown error
-		}
-		else if ((addr = findVar(inTxt, inCurs)) != NOT_FOUND){									// Variable
-			outCurs[START] = STRING;
-			*outTxt = vars.dict[addr].val;
-			return FALSE;
+struct loopStruct *parseChain(char *txt, long *cursors, int *links){
+	// Parse dot-separated iterators, such as text.column[3].date, into a chain of links
+	// Leaves cursors[STOP] on the character after the final iterator
+	// Links are kept in the context, so nothing is stranded if parsing throws
+	struct loopStack *chain = &grain->chain;
+	*links = 0;
+	do {
+		if (*links == chain->cap) chain->stack = realloc(chain->stack, (chain->cap = chain->cap ? chain->cap * 2 : 4) * sizeof(struct loopStruct));
+		struct loopStruct *link = &chain->stack[(*links)++];
+
+		getNextToken(txt, cursors);
+		if (*links == 1 && (link->addr = findFileIter(txt, cursors)) != NOT_FOUND) link->type = FILE_ITER;
+		else if ((link->addr = findFieldIter(txt, cursors)) != NOT_FOUND) link->type = FIELD_ITER;
+		else throwError(NOT_EXIST, txt, cursors[START], cursors[STOP]);
+
+		if (txt[cursors[STOP]] == '['){
+			getNextToken(txt, cursors);
+			link->isLoop = FALSE;
+			link->index = (int)token2Num(txt, cursors);
+			++cursors[STOP];
 		}
-		else if ((addr=findFieldIter(inTxt, inCurs)) != NOT_FOUND ) throwError(NO_INDEX, fields.dict[addr].key, FIELD_ITER, -1);
-		else if ((addr=findFileIter(inTxt, inCurs)) != NOT_FOUND) throwError(NO_INDEX, files.dict[addr].key, FILE_ITER, -1);
-		else throwError(NOT_EXIST, inTxt, inCurs[START], inCurs[STOP]);								// Unknown error
-	case COMMA:
-	case TERMINATOR:
-		return TERMINATOR;
-	default:
-		fprintf(stderr, "Unknown token\n");
-		exit(1);
+		else link->isLoop = TRUE;
+	} while (txt[cursors[STOP]] == '.');
+	return chain->stack;
+}
+
+void accumulate(struct aggregate *agg, char *txt, long start, long stop){
+	// Add txt[start-stop] to running aggregate.  Empty values are ignored.
+	if (start >= stop) return;
+	else if (agg->type == OCCURS){
+		struct fieldDict *field = &grain->fields.dict[agg->field];
+		agg->count += countDelimiter(txt, field->val, field->len, start, stop, NULL);
+		return;
 	}
+	else if (agg->type != COUNT){
+		long cursors[2] = {start, stop};
+		struct number value = substring2Number(txt, cursors);
+		if (agg->count == 0 || compareNumbers(value, agg->min) < 0) agg->min = value;
+		if (agg->count == 0 || compareNumbers(value, agg->max) > 0) agg->max = value;
+		agg->sum = numberOp(agg->sum, '+', value);
+	}
+	++agg->count;
 }
 
-char *varStrAss(char *scriptLine, int *cursors){
-	// Assign multiple concatenated strings to a variable
-	char *out = NULL, *buff;
-	int freeBuff, buffCurs[2];
-	while (scriptLine[cursors[STOP]] != ',' && (freeBuff=retrieveToken(buffCurs, &buff, scriptLine, cursors)) != TERMINATOR){
-		out = buffCurs[START] == STRING ? stringJoin(out, buff) : substringJoin(out, buff, buffCurs[START], buffCurs[STOP]);
-		if (freeBuff) free(buff); 
+void aggregateFields(struct loopStruct *chain, int links, char *buff, long start, long stop, struct fileDict *file, long origin, struct aggregate *agg){
+	// Walk field iterator chain over buff[start-stop], accumulating every span of the final link
+	// Mirrors resetLoop() and loadLoop() without dispatching each span through the script
+	// If buff[start-stop] is a whole record, file is its file iterator and origin its offset.  Otherwise file is NULL.
+	if (links == 0) return accumulate(agg, buff, start, stop);
+
+	struct fieldDict *field = &grain->fields.dict[chain->addr];
+	long end;
+	if (chain->isLoop == FALSE){
+		if ((start = skipCached(file, origin, buff, chain->addr, chain->index, start, stop)) == NOT_FOUND) return;
+		if ((end = getNextField(buff, field->val, start, stop)) == NOT_FOUND) end = stop;
+		aggregateFields(chain + 1, links - 1, buff, start, end, NULL, 0, agg);
+	}
+	else while (TRUE){
+		if ((end = getNextField(buff, field->val, start, stop)) == NOT_FOUND) end = stop;
+		aggregateFields(chain + 1, links - 1, buff, start, end, NULL, 0, agg);
+		if (field->val == NULL) start = end >= stop ? stop + 1 : skipWhitespace(buff, end);
+		else start = end + field->len;
+		if (start > stop || field->val != NULL && field->val[0] == 0 && start == stop) break;
 	}
-	return out;
 }
 
-char *varMthAss(int varAddr, char *scriptLine, int *cursors){
-	float augend = string2Num(vars.dict[varAddr].val), addend;
+char *aggregate(int type, char *txt, long *cursors){
+	// Evaluate sum(), min(), max(), mean(), count() or occurs() over an iterator chain.  Returns result as new string.
+	int links;
+	long length;
+	struct loopStruct *chain = parseChain(txt, cursors, &links);
+	struct aggregate agg = {type, 0, 0, {TRUE, 0, 0}, {TRUE, 0, 0}, {TRUE, 0, 0}};
+
+	if (type == OCCURS && links == 1 && chain->type == FILE_ITER) agg.count = occursFile(&grain->files.dict[chain->addr]);
+	else {
+		// occurs() counts the final link's delimiter within each span of the link before it
+		if (type == OCCURS) agg.field = chain[--links].addr;
+
+		if (chain->type == FILE_ITER){
+			// Consume file records, just like an 'in' loop would
+			struct fileDict *file = &grain->files.dict[chain->addr];
+			char *buff = NULL;
+			int slot = own(NULL);
+			if (chain->isLoop == FALSE) {
+				if ((buff = loadFile(NULL, file, &length, chain->index)) != NULL) reown(slot, buff), aggregateFields(chain + 1, links - 1, buff, 0, length, file, file->origin, &agg);
+			}
+			else while ((buff = loadFile(buff, file, &length, 0)) != NULL) reown(slot, buff), aggregateFields(chain + 1, links - 1, buff, 0, length, file, file->origin, &agg);
+			freeRecord(buff);
+			disown(slot);
+		}
+		else if (grain->loops.ptr == NO_LOOP) throwError(NO_FILE_ITER, grain->fields.dict[chain->addr].key, -1, -1);
+		else {
+			struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
+			aggregateFields(chain, links, loop->buff, loop->start, loop->stop, loop->type == FILE_ITER ? &grain->files.dict[loop->addr] : NULL, loop->origin, &agg);
+		}
+	}
+
+	struct number count = {TRUE, agg.count, (double)agg.count};
+	// Nothing to take the minimum, maximum or mean of.  Empty, so it cannot be mistaken for a value of 0
+	if (agg.count == 0 && (type == MIN || type == MAX || type == MEAN)) return stringSave(NULL, "");
+	switch (type){
+	case MIN:
+		return num2String(NULL, agg.min);
+	case MAX:
+		return num2String(NULL, agg.max);
+	case MEAN:
+		return num2String(NULL, numberOp(agg.sum, '/', count));
+	case COUNT:
+	case OCCURS:
+		return num2String(NULL, count);
+	default:
+		return num2String(NULL, agg.sum);
+	}
+}
+
+int parseOperand(struct operand *op, int type, char *txt, long *cursors){
+	// Parse the token of the given type just read from txt[START-STOP] into op, without raising an error
+	// Returns QUOTE, DOLLAR, VARIABLE, FIELD_ITER or TERMINATOR.  Returns NOT_FOUND, with cursors left on the token,
+	// for aggregates, file iterators and anything retrieveToken() would reject
+	op->indexVar = op->slot = NOT_FOUND;
+	switch (op->type = type){
+	case DOLLAR:
+		return txt[cursors[START]] == '$' ? DOLLAR : NOT_FOUND;
+	case NUMBER:
+	case QUOTE:
+		op->txt = txt, op->start = cursors[START], op->stop = cursors[STOP];
+		return op->type = QUOTE;
+	case VARIABLE:
+		if (txt[cursors[STOP]] == '['){
+			// Index as token2Num() reads it: a number, or a variable holding one
+			long curs[2] = {cursors[START], cursors[STOP]};
+			int error;
+			if ((op->addr = findFieldIter(txt, cursors)) == NOT_FOUND || scanToken(txt, curs, &error) == NOT_FOUND) return NOT_FOUND;
+			else if (txt[curs[START]] >= 48 && txt[curs[START]] <= 57){
+				if (!isNumber(txt, curs[START], curs[STOP])) return NOT_FOUND;
+				op->index = (int)substring2Num(txt, curs);
+			}
+			else {
+				if ((op->indexVar = findVar(txt, curs)) == NOT_FOUND || !isNumber(grain->vars.dict[op->indexVar].val, 0, strlen(grain->vars.dict[op->indexVar].val))) return NOT_FOUND;
+				op->index = (int)string2Num(grain->vars.dict[op->indexVar].val);
+			}
+			cursors[START] = curs[START], cursors[STOP] = curs[STOP];
+			return op->type = FIELD_ITER;
+		}
+		return txt[cursors[STOP]] != '(' && (op->addr = findVar(txt, cursors)) != NOT_FOUND ? VARIABLE : NOT_FOUND;
+	case COMMA:
+	case TERMINATOR:
+		return TERMINATOR;
+	default:
+		return NOT_FOUND;
+	}
+}
+
+int operandValue(struct operand *op, struct loopStruct *loop, long *curs, char **txt){
+	// Value of an operand parsed by parseOperand(), as retrieveToken() returns it.  $ and fields are read from loop
+	// Returns FALSE if the field is missing
+	switch (op->type){
+	case QUOTE:
+		curs[START] = op->start, curs[STOP] = op->stop;
+		*txt = op->txt;
+		return TRUE;
+	case VARIABLE:
+		curs[START] = STRING;
+		*txt = grain->vars.dict[op->addr].val;
+		return TRUE;
+	case DOLLAR:
+		// User provided dollar ($), which means "entire buffer"
+		if (loop->type == FIELD_ITER) curs[START] = loop->start, curs[STOP] = loop->stop;
+		else curs[START] = STRING;
+		*txt = loop->buff;
+		return TRUE;
+	default:
+		curs[START] = skipCached(loop->type == FILE_ITER ? &grain->files.dict[loop->addr] : NULL, loop->origin, loop->buff, op->addr, op->index, loop->start, loop->stop);
+		if (curs[START] == NOT_FOUND) return FALSE;
+		if ((curs[STOP] = getNextField(loop->buff, grain->fields.dict[op->addr].val, curs[START], loop->stop)) == NOT_FOUND) curs[STOP] = loop->stop;
+		*txt = loop->buff;
+		return TRUE;
+	}
+}
+
+int retrieveToken(long *outCurs, char **outTxt, char *inTxt, long *inCurs){
+	// Converts next token to value.  Gets token from inTxt[start-stop].  Returns string in outTxt[start-stop]
+	// Token could refer to a variable, file iterator or field iterator.  Could be a number or string quote.
+	// If substring, puts start/stop in outCurs.  Else string, puts STRING (-1) in outCurs[START]
+	// If memory allocated for string, returns TRUE.  Else returns FALSE.
+	// If no token, returns TERMINATOR (-1)
+
+	struct operand op;
+	int addr, type = getNextToken(inTxt, inCurs);
+	long length;
+	switch (parseOperand(&op, type, inTxt, inCurs)){
+	case TERMINATOR:
+		return TERMINATOR;
+	case QUOTE:
+	case VARIABLE:
+		operandValue(&op, NULL, outCurs, outTxt);
+		return FALSE;
+	case DOLLAR:
+		if (grain->loops.ptr == NO_LOOP) throwError(NO_BUFFER, NULL, -1, -1);
+		operandValue(&op, &grain->loops.stack[grain->loops.ptr], outCurs, outTxt);
+		return FALSE;
+	case FIELD_ITER:
+		if (grain->loops.ptr == NO_LOOP) throwError(NO_FILE_ITER, grain->fields.dict[op.addr].key, -1, -1);
+		if (!operandValue(&op, &grain->loops.stack[grain->loops.ptr], outCurs, outTxt)) throwError(OOR, grain->fields.dict[op.addr].key, op.index, FIELD_ITER);
+		return FALSE;
+	}
+
+	// Aggregates, file iterators and errors
+	switch (type){
+	case DOLLAR:
+		throwError(NO_DOLLAR, &inTxt[inCurs[START]], -1, -1);
+	case VARIABLE:
+		if (inTxt[inCurs[STOP]] == '('){											// Aggregate
+			if ((addr = findAggregate(inTxt, inCurs)) == NOT_FOUND) throwError(NOT_EXIST, inTxt, inCurs[START], inCurs[STOP]);
+			outCurs[START] = STRING;
+			*outTxt = aggregate(addr, inTxt, inCurs);
+			return TRUE;
+		}
+		else if (inTxt[inCurs[STOP]] == '['){ 											// Iterator
+			if ((addr = findFieldIter(inTxt, inCurs)) != NOT_FOUND) { 							// Field iterator, index in error
+				if (grain->loops.ptr == NO_LOOP) throwError(NO_FILE_ITER, grain->fields.dict[addr].key, -1, -1);
+				getNextToken(inTxt, inCurs);
+				op.type = FIELD_ITER, op.addr = addr, op.index = (int)token2Num(inTxt, inCurs);
+				if (!operandValue(&op, &grain->loops.stack[grain->loops.ptr], outCurs, outTxt)) throwError(OOR, grain->fields.dict[addr].key, op.index, FIELD_ITER);
+				return FALSE;
+			}
+			else if ((addr = findFileIter(inTxt, inCurs)) != NOT_FOUND){							// File iterator
+				getNextToken(inTxt, inCurs);
+				outCurs[START] = STRING;
+				*outTxt = loadFile(NULL, &grain->files.dict[addr], &length, (int)token2Num(inTxt, inCurs));
+				return TRUE;
+			}
+			else if ((addr = findVar(inTxt, inCurs)) != NOT_FOUND) throwError(INDEX_VAR, grain->vars.dict[addr].key, -1, -1);	// Var error
+			else throwError(NOT_EXIST, inTxt, inCurs[START], inCurs[STOP]);							// Unknown error
+		}
+		else if ((addr=findFieldIter(inTxt, inCurs)) != NOT_FOUND ) throwError(NO_INDEX, grain->fields.dict[addr].key, FIELD_ITER, -1);
+		else if ((addr=findFileIter(inTxt, inCurs)) != NOT_FOUND) throwError(NO_INDEX, grain->files.dict[addr].key, FILE_ITER, -1);
+		else throwError(NOT_EXIST, inTxt, inCurs[START], inCurs[STOP]);								// Unknown error
+	default:
+		throwError(BAD_TOKEN, &inTxt[inCurs[START]], -1, -1);
+	}
+}
+
+void varSet(int addr, char *src, long length){
+	// Overwrite variable with src[0-length], reusing its storage where possible
+	struct varDict *var = &grain->vars.dict[addr];
+	if (length >= var->cap){
+		long cap = 2 * var->cap > length ? 2 * var->cap : length + 1;
+		var->val = realloc(var->val == var->small ? NULL : var->val, cap * sizeof(char));
+		var->cap = cap;
+	}
+	memmove(var->val, src, length);
+	var->val[length] = 0;
+}
+
+void relinkVars(){
+	// vars.dict has moved: repoint inline values, and loops reading from them
+	for (int var=0; var < grain->vars.count; ++var) if (grain->vars.dict[var].cap <= SMALL_SIZE) grain->vars.dict[var].val = grain->vars.dict[var].small;
+	for (int ptr=0; ptr <= grain->loops.ptr; ++ptr){
+		if (grain->loops.stack[ptr].type == VAR) grain->loops.stack[ptr].buff = grain->vars.dict[grain->loops.stack[ptr].addr].val;
+		else if (grain->loops.stack[ptr].type == FIELD_ITER) grain->loops.stack[ptr].buff = grain->loops.stack[ptr-1].buff;
+	}
+}
+
+long scratchJoin(long length, char *src, long from, long to){
+	// Append src[from-to] to scratch, or all of src if from == STRING.  Returns new length
+	if (from == STRING) from = 0, to = strlen(src);
+	if (length + to - from >= grain->scratch.cap){
+		grain->scratch.cap = 2 * (length + to - from) + 1;
+		grain->scratch.txt = realloc(grain->scratch.txt, grain->scratch.cap * sizeof(char));
+	}
+	memcpy(&grain->scratch.txt[length], &src[from], to - from);
+	return length + to - from;
+}
+
+int newVar(char *txt, long *cursors){
+	// Allocate an empty variable named txt[START-STOP].  Returns its address
+	int addr = grain->vars.count++;
+	grain->vars.dict = realloc(grain->vars.dict, grain->vars.count * sizeof(struct varDict));
+	grain->vars.dict[addr].cap = SMALL_SIZE;
+	grain->vars.dict[addr].small[0] = 0;
+	relinkVars();
+	grain->vars.dict[addr].key = substringSave(NULL, txt, cursors);
+	return addr;
+}
+
+void varStrAss(int varAddr, char *scriptLine, long *cursors){
+	// Assign multiple concatenated strings to a variable
+	char *buff;
+	int freeBuff;
+	long buffCurs[2], length = 0;
+	while (scriptLine[cursors[STOP]] != ',' && (freeBuff=retrieveToken(buffCurs, &buff, scriptLine, cursors)) != TERMINATOR){
+		length = scratchJoin(length, buff, buffCurs[START], buffCurs[STOP]);
+		if (freeBuff) freeRecord(buff); 
+	}
+	varSet(varAddr, length ? grain->scratch.txt : "", length);
+}
+
+void varMthAss(int varAddr, char *scriptLine, long *cursors){
+	struct number augend = string2Number(grain->vars.dict[varAddr].val), addend;
 	do {
 		char op = scriptLine[cursors[START]];
 		char *subTxt;
-		int augCurs[2];
-		int toFree = retrieveToken(augCurs, &subTxt, scriptLine, cursors);
-		addend = augCurs[START] == STRING ? string2Num(subTxt) : substring2Num(subTxt, augCurs);
-		if (toFree == TRUE) free(subTxt);
-		switch(op){
-		case '+':
-			augend += addend;
-			break;
-		case '-':
-			augend -= addend;
-			break;
-		case '*':
-			augend *= addend;
-			break;
-		case '/':
-			augend /= addend;
-			break;
-		case '%':
-			augend = (int)augend % (int)addend;
-			break;
-		}
+		long augCurs[2];
+		int toFree = retrieveToken(augCurs, &subTxt, scriptLine, cursors), slot = toFree == TRUE ? own(subTxt) : -1;
+		addend = augCurs[START] == STRING ? string2Number(subTxt) : substring2Number(subTxt, augCurs);
+		if (toFree == TRUE) freeRecord(subTxt), disown(slot);
+		augend = numberOp(augend, op, addend);
 	} while (getNextToken(scriptLine, cursors) != TERMINATOR);
-	return num2String(vars.dict[varAddr].val, augend);
+	char buff[NUM_SIZE];
+	varSet(varAddr, buff, formatNumber(buff, augend));
 }
 
-int compareTokens(char *txtA, int *cursA, char *txtB, int *cursB){
+int compareTokens(char *txtA, long *cursA, char *txtB, long *cursB){
 	// Return 0 if A == B ; > 0 if A > B ; < 0 if A < B
 
 	// Inefficient.  IsNum() functions are used, then used again in the 2Num() functions.
 	int aIsNum = cursA[START] == STRING ? stringIsNum(txtA) : substringIsNum(txtA, cursA[START], cursA[STOP]);
 	int bIsNum = cursB[START] == STRING ? stringIsNum(txtB) : substringIsNum(txtB, cursB[START], cursB[STOP]);
 	if (aIsNum && bIsNum){
-		float a = cursA[START] == STRING ? string2Num(txtA) : substring2Num(txtA, cursA);
-		float b = cursB[START] == STRING ? string2Num(txtB) : substring2Num(txtB, cursB);
-		return a == b ? 0 : a > b ? 1 : -1;
+		struct number a = cursA[START] == STRING ? string2Number(txtA) : substring2Number(txtA, cursA);
+		struct number b = cursB[START] == STRING ? string2Number(txtB) : substring2Number(txtB, cursB);
+		return compareNumbers(a, b);
 	}
 	else {
-		int result;
-		for(int aPos=cursA[START] == STRING ? 0 : cursA[START], bPos=cursB[START] == STRING ? 0 : cursB[START]  ; 
-			(cursA[START] == STRING && txtA[aPos] != 0 || cursA[START] != STRING && aPos < cursA[STOP]) 
-		     && (cursB[START] == STRING && txtB[bPos] != 0 || cursB[START] != STRING && bPos < cursB[STOP]) 
-		     && (result = txtA[aPos]-txtB[bPos]) == 0 ; ++aPos, ++bPos); 
-		return result;
+		// A string that runs out first sorts first
+		long aPos = cursA[START] == STRING ? 0 : cursA[START], bPos = cursB[START] == STRING ? 0 : cursB[START];
+		int aMore, bMore;
+		for ( ; (aMore = cursA[START] == STRING ? txtA[aPos] != 0 : aPos < cursA[STOP])
+		     &  (bMore = cursB[START] == STRING ? txtB[bPos] != 0 : bPos < cursB[STOP])
+		     && txtA[aPos] == txtB[bPos] ; ++aPos, ++bPos);
+		return (aMore ? txtA[aPos] : 0) - (bMore ? txtB[bPos] : 0);
 	}
 }
 
-int comparator(char *scriptLine, int *cursors){
-	// Return TRUE/FALSE result of statement
-	// Gets tokens from IF and interprets comparator operand
-	int cursA[2], cursB[2];
-	char *txtA, *txtB;
-	
-	int freeA = retrieveToken(cursA, &txtA, scriptLine, cursors), freeB, result;
-
-	int operator = getNextToken(scriptLine, cursors);
+int compareResult(char *txtA, long *cursA, char *txtB, long *cursB, int operator, int inc){
+	// Return TRUE/FALSE result of A operator B, where operator is LE to NE, or VARIABLE for 'inc' (inc TRUE) and 'exc'
+	// Returns NOT_FOUND for any other operator
 	if (operator == VARIABLE){
-		int inc = substringEquals("inc", scriptLine, cursors);
-		freeB = retrieveToken(cursB, &txtB, scriptLine, cursors);
-		
 		// getNextField() requires txtA start/stop coords
 		if (cursA[START] == STRING) for (cursA[STOP]=0; txtA[cursA[STOP]] != 0; ++cursA[STOP]);
 
@@ -687,54 +1804,61 @@ int comparator(char *scriptLine, int *cursors){
 			txtB[cursB[STOP]] = 0;
 		}
 
-		result = (getNextField(txtA, &txtB[cursB[START]], cursA[START] == -1 ? 0 : cursA[START], cursA[STOP]) != NOT_FOUND);
-		if (!inc) result = !result;
+		int result = (getNextField(txtA, cursB[START] == STRING ? txtB : &txtB[cursB[START]], cursA[START] == -1 ? 0 : cursA[START], cursA[STOP]) != NOT_FOUND);
 		if (cursB[START] != STRING) txtB[cursB[STOP]] = swap;
+		return inc ? result : !result;
 	}
-	else {
-		freeB = retrieveToken(cursB, &txtB, scriptLine, cursors);
-		result = compareTokens(txtA, cursA, txtB, cursB);
-		switch (operator){
-			case LT:
-				result = result < 0;
-				break;
-			case LE:
-				result = result <= 0;
-				break;
-			case GT:
-				result = result > 0;
-				break;
-			case GE:
-				result = result >= 0;
-				break;
-			case EQ:
-				result = result == 0;
-				break;
-			case NE:
-				result = result != 0;
-				break;
-			default:
-				fprintf(stderr, "Comparator %i not recognised\n", operator);
-				exit(1);
-		}
+
+	int result = compareTokens(txtA, cursA, txtB, cursB);
+	switch (operator){
+		case LT:
+			return result < 0;
+		case LE:
+			return result <= 0;
+		case GT:
+			return result > 0;
+		case GE:
+			return result >= 0;
+		case EQ:
+			return result == 0;
+		case NE:
+			return result != 0;
+		default:
+			return NOT_FOUND;
 	}
+}
+
+int comparator(char *scriptLine, long *cursors){
+	// Return TRUE/FALSE result of statement
+	// Gets tokens from IF and interprets comparator operand
+	long cursA[2], cursB[2];
+	char *txtA, *txtB;
+	
+	int freeA = retrieveToken(cursA, &txtA, scriptLine, cursors), freeB, result;
+	int slotA = freeA == TRUE ? own(txtA) : -1, slotB = -1;
+
+	int operator = getNextToken(scriptLine, cursors);
+	int inc = operator == VARIABLE && substringEquals("inc", scriptLine, cursors);
+	freeB = retrieveToken(cursB, &txtB, scriptLine, cursors);
+	if (freeB == TRUE) slotB = own(txtB);
+	if ((result = compareResult(txtA, cursA, txtB, cursB, operator, inc)) == NOT_FOUND) throwError(BAD_TOKEN, &scriptLine[cursors[START]], -1, -1);
 
 	int andFlag=FALSE, orFlag=FALSE;
 	if ( getNextToken(scriptLine, cursors) != TERMINATOR && (andFlag=substringEquals("and", scriptLine, cursors)) == FALSE ) 
 		orFlag = substringEquals("or", scriptLine, cursors);
 
-	if (freeA) free(txtA);
-	if (freeB) free(txtB);
+	if (freeA == TRUE) freeRecord(txtA), disown(slotA);
+	if (freeB == TRUE) freeRecord(txtB), disown(slotB);
 
 	if (result == TRUE) return andFlag ? comparator(scriptLine, cursors) : TRUE;
 	else return orFlag ? comparator(scriptLine, cursors) : FALSE;
 }
 
-int nextIf(char *scriptLine, FILE *scriptFile, int *cursors){
+int nextIf(char *scriptLine, FILE *scriptFile, long *cursors){
 	// Finds next IF block
 	// Returns TRUE if execution should resume
 	// Returns FALSE if a further "elif" test is required
-	while (fgets(scriptLine, READ_SIZE + 1, scriptFile) && !feof(scriptFile)){
+	while (fgets(scriptLine, READ_SIZE + 1, scriptFile) != NULL){
 		cursors[STOP] = -1;
 		getNextToken(scriptLine, cursors);
 		if (substringEquals("elif", scriptLine, cursors)) return FALSE;
@@ -746,274 +1870,1878 @@ int nextIf(char *scriptLine, FILE *scriptFile, int *cursors){
 
 void endLoop(char *scriptLine, FILE *scriptFile){
 	for (int loopCount=1; loopCount; ){
-		fgets(scriptLine, READ_SIZE + 1, scriptFile);
-		if (feof(scriptFile)) throwError(NO_OUT, NULL, -1, -1);
-		int cursors[2] = {-1, -1};
+		if (fgets(scriptLine, READ_SIZE + 1, scriptFile) == NULL) throwError(NO_OUT, NULL, -1, -1);
+		long cursors[2] = {-1, -1};
 		getNextToken(scriptLine, cursors);
 		if (substringEquals("in", scriptLine, cursors)) ++loopCount;
 		else if (substringEquals("out", scriptLine, cursors)) --loopCount;
 	}
 }
 
-int main(int argc, char **argv){
-	vars.count = 0, vars.dict = NULL;
-	fields.count = 0, fields.dict = NULL;
-	files.count = 0, files.dict = NULL;
-	loops.ptr = -1, loops.cap = 0, loops.stack = NULL;
-	char scriptLine[READ_SIZE + 1];
-	FILE *scriptFile = fopen(argv[1], "r");
-	for ( fgets(scriptLine, READ_SIZE + 1, scriptFile) ; !feof(scriptFile); fgets(scriptLine, READ_SIZE + 1, scriptFile) ) {
-		int cursors[2] = {0, -1};
-		if (getNextToken(scriptLine, cursors) == TERMINATOR) continue;
-		else if (substringEquals("var", scriptLine, cursors)){
-			do {
-				getNextToken(scriptLine, cursors);
-				int addr;
-				if ((addr = findFieldIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, fields.dict[addr].key, FIELD_ITER, -1);
-				else if ((addr = findFileIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, files.dict[addr].key, FILE_ITER, -1);
-				else if ((addr = findVar(scriptLine, cursors)) == NOT_FOUND){
-					// Allocate new variable
-					addr = vars.count++;
-					vars.dict = realloc(vars.dict, vars.count * sizeof(struct varDict));
-					vars.dict[addr].val = NULL;
-					vars.dict[addr].key = substringSave(NULL, scriptLine, cursors);
-				}
-			
-				switch(scriptLine[cursors[STOP]]){
-				case '=':
-					// String assignment without whitespace
-					vars.dict[addr].val = varStrAss(scriptLine, cursors);
-					break;
-				case '+':
-				case '-':
-				case '/':
-				case '*':
-				case '%':
-					// Maths assignment without whitespace
-					if (scriptLine[cursors[STOP]+1] != '=') throwError(NO_EQUALS, &scriptLine[cursors[STOP]+1], -1, -1);
-					vars.dict[addr].val = realloc(vars.dict[addr].val, 2 * sizeof(char));
-					vars.dict[addr].val[0] = '0';
-					vars.dict[addr].val[1] = '\0';
-					vars.dict[addr].val = varMthAss(addr, scriptLine, cursors);
-					break;
-				default:
-					switch(getNextToken(scriptLine,cursors)){
-					case ASSIGNMENT:
-						// String assignment with whitespace
-						vars.dict[addr].val = varStrAss(scriptLine, cursors);
-						break;
-					case MATHS:
-						// Maths assignment with whitespace
-						if (scriptLine[cursors[STOP]] != '=') throwError(NO_EQUALS, &scriptLine[cursors[STOP]], -1, -1);
-						vars.dict[addr].val = realloc(vars.dict[addr].val, 2 * sizeof(char));
-						vars.dict[addr].val[0] = '0';
-						vars.dict[addr].val[1] = '\0';
-						vars.dict[addr].val = varMthAss(addr, scriptLine, cursors);
-						break;
-					default:
-						if (vars.dict[addr].val == NULL || vars.dict[addr].val[0] != 0){
-							// No assignment: initialise empty variable
-							vars.dict[addr].val = realloc(vars.dict[addr].val, sizeof(char));
-							vars.dict[addr].val[0] = 0;
-						}
-						break;
-					}
-				}
-			} while (scriptLine[cursors[START]] == ',' || scriptLine[cursors[STOP]] == ','); // Multiple comma-separated var declarations
-		}
-		else if (substringEquals("print", scriptLine, cursors)){
-			char *buff;
-			int freeBuff, printCurs[2];
-			while ( (freeBuff=retrieveToken(printCurs, &buff, scriptLine, cursors)) != TERMINATOR){
-				if (printCurs[START] == NOT_FOUND) printf("%s", buff);
-				else printSubstring(buff, printCurs[START], printCurs[STOP]);
-				if (freeBuff == TRUE) free(buff);
-			}
+int beginLoop(char *scriptLine, long *cursors, FILE *scriptFile){
+	// Push the iterator chain of an 'in' statement onto the loop stack
+	// Returns TRUE if the loop body should be run, FALSE if there is nothing to iterate
+	int base = grain->loops.ptr + 1;
+	do {
+		if (++grain->loops.ptr == grain->loops.cap){
+			++grain->loops.cap;
+			grain->loops.stack = realloc(grain->loops.stack, grain->loops.cap * sizeof(struct loopStruct));
 		}
-		else if (substringEquals("file", scriptLine, cursors)){
-			// Get name
-			getNextToken(scriptLine, cursors);
 
-			int addr;
-			if ((addr = findVar(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, vars.dict[addr].key, VAR, -1);
-			else if ((addr = findFieldIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, fields.dict[addr].key, FIELD_ITER, -1);
-			else if ((addr = findFileIter(scriptLine, cursors)) == NOT_FOUND){
-				// Allocate new file iterator
-				addr = files.count++;
-				files.dict = realloc(files.dict, files.count * sizeof(struct fileDict));
-				files.dict[addr].key = substringSave(NULL, scriptLine, cursors);
-			}
-			else {
-				// Clear/Close this file iterator
-				free(files.dict[addr].delimiter);
-				fclose(files.dict[addr].fp);
-			}
+		struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
 
-			struct fileDict *file = &files.dict[addr];
+		// Save cmd.  No buffer yet, for clearLoops() to free should the chain throw.
+		loop->cmd = -1;
+		loop->buff = NULL;
 
-			// Get filename
-			if (getNextToken(scriptLine, cursors) == QUOTE) {
-				char swap = scriptLine[cursors[STOP]];
-				scriptLine[cursors[STOP]] = 0;
-				file->fp = fopen(&scriptLine[cursors[START]], "r");
-				scriptLine[cursors[STOP]] = swap;
-			}
-			else file->fp = fopen(vars.dict[findVar(scriptLine, cursors)].val, "r");
+		// Get type and addr.  Variables and strings may only begin a chain.
+		if (getNextToken(scriptLine, cursors) == QUOTE && grain->loops.ptr == base){
+			loop->type = LITERAL;
+			loop->buff = substringSave(NULL, scriptLine, cursors);
+			++cursors[STOP];
+		}
+		else if ( (loop->addr = findFileIter(scriptLine, cursors)) != NOT_FOUND) loop->type = FILE_ITER;
+		else if (grain->loops.ptr == base && (loop->addr = findVar(scriptLine, cursors)) != NOT_FOUND) loop->type = VAR;
+		else {
+			if (!grain->loops.ptr) throwError(NO_FILE_ITER, scriptLine, cursors[START], cursors[STOP]);
+			if ((loop->addr = findFieldIter(scriptLine, cursors)) == NOT_FOUND) throwError(NOT_EXIST, scriptLine, cursors[START], cursors[STOP]);
+			loop->type = FIELD_ITER;
+		}
 
-			// Get delimiter
-			if (scriptLine[cursors[STOP]] == ',' || getNextToken(scriptLine, cursors) == COMMA){
-				switch(getNextToken(scriptLine, cursors)){
-				case QUOTE:
-					file->len = cursors[STOP] - cursors[START];
-					file->delimiter = substringSave(NULL, scriptLine, cursors);
-					break;
-				case MATHS:
-					if (scriptLine[cursors[START]] != '*') ; // throw some kind of error
-					else ; // load entire file
-				case DOLLAR:
-					// What if they put a file segment into a file segment?
-					// retrieveToken() might be a better choice for this switch statement
-				case VARIABLE:
-					file->delimiter = stringSave(NULL, vars.dict[findVar(scriptLine, cursors)].val);
-					for (file->len = 0; file->delimiter[file->len] != 0; ++file->len);
-				default:
-					// Raise invalid token error
-				}
-			}
-			else {  // No delimiter provided.  Default = newline (\n)
-				file->len = 1;
-				file->delimiter = malloc(2 * sizeof(char));
-				file->delimiter[0] = '\n';
-				file->delimiter[1] = 0;
-			}
+		// Get index
+		if (loop->type == VAR || loop->type == LITERAL){
+			if (scriptLine[cursors[STOP]] == '[') throwError(INDEX_VAR, loop->type == VAR ? grain->vars.dict[loop->addr].key : loop->buff, -1, -1);
+			loop->isLoop = FALSE;
+			loop->index = NO_INDEX;
 		}
-		else if (substringEquals("field", scriptLine, cursors)){
-			// Get name
+		else if (scriptLine[cursors[STOP]] == '['){
+			loop->isLoop = FALSE;
 			getNextToken(scriptLine, cursors);
-			int addr;
-			if ((addr = findVar(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, vars.dict[addr].key, VAR, -1);
-			else if ((addr = findFileIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, files.dict[addr].key, FILE_ITER, -1);
-			else if ((addr=findFieldIter(scriptLine, cursors)) == NOT_FOUND){
-				addr = fields.count++;
-				fields.dict = realloc(fields.dict, fields.count * sizeof(struct fieldDict));
-				fields.dict[addr].key = substringSave(NULL, scriptLine, cursors);
-			}
-			else free(fields.dict[addr].val);
+			loop->index = (int)token2Num(scriptLine, cursors);
+			++cursors[STOP];
+		}
+		else {
+			loop->isLoop = TRUE;
+			loop->index = loop->type == FIELD_ITER? -1 : 0;
+		}
+
+		loop->chain = FALSE; 
+		grain->loops = resetLoop(scriptLine, scriptFile);
+
+	} while ( grain->loops.ptr >= base && (grain->loops.stack[grain->loops.ptr].chain = (scriptLine[cursors[STOP]] == '.')) );
+
+	return grain->loops.ptr >= base;
+}
+
+void breakLoop(){
+	// Pop the innermost loop, along with the rest of its chain
+	do {
+		if (grain->loops.stack[grain->loops.ptr].type == FILE_ITER || grain->loops.stack[grain->loops.ptr].type == LITERAL) freeRecord(grain->loops.stack[grain->loops.ptr].buff);
+	} while ( --grain->loops.ptr >= 0 && grain->loops.stack[grain->loops.ptr].chain == TRUE);
+}
+
+int isBorrowed(int addr){
+	// TRUE if an 'in' loop is reading from the variable
+	for (int ptr=0; ptr <= grain->loops.ptr; ++ptr) if (grain->loops.stack[ptr].type == VAR && grain->loops.stack[ptr].addr == addr) return TRUE;
+	return FALSE;
+}
+
+void checkBorrowed(int addr){
+	// Variables cannot change while an 'in' loop is reading from them
+	if (isBorrowed(addr)) throwError(BORROWED, grain->vars.dict[addr].key, -1, -1);
+}
+
+int isPlain(struct number num);
+struct number roundNumber(struct number num);
+
+void addEntry(int type){
+	// Append an entry for the next statement to the plan
+	struct columnBuffers *col = &grain->columns;
+	if (col->entryCount == col->entryCap){
+		col->entryCap = col->entryCap ? 2 * col->entryCap : 16;
+		col->entries = realloc(col->entries, col->entryCap * sizeof(struct columnEntry));
+	}
+	col->entries[col->entryCount++] = (struct columnEntry){type, type == TEST ? col->testCount : col->operandCount, 0, NOT_FOUND, NOT_FOUND, FALSE, NOT_FOUND};
+	if (type == MTH_ASS) col->entries[col->entryCount - 1].slot = col->resultCount++;
+}
+
+void addOperand(struct operand *op){
+	// Append an operand to the last entry.  A field printed gets a column of spans
+	struct columnBuffers *col = &grain->columns;
+	if (col->operandCount == col->operandCap){
+		col->operandCap = col->operandCap ? 2 * col->operandCap : 32;
+		col->operands = realloc(col->operands, col->operandCap * sizeof(struct operand));
+	}
+	if (op->type == FIELD_ITER && col->entries[col->entryCount - 1].type == PRINT) op->slot = col->spanCount++;
+	col->operands[col->operandCount++] = *op;
+	++col->entries[col->entryCount - 1].count;
+}
+
+void addTest(struct test *test){
+	// Append a test to the last entry
+	struct columnBuffers *col = &grain->columns;
+	if (col->testCount == col->testCap){
+		col->testCap = col->testCap ? 2 * col->testCap : 16;
+		col->tests = realloc(col->tests, col->testCap * sizeof(struct test));
+	}
+	col->tests[col->testCount++] = *test;
+	++col->entries[col->entryCount - 1].count;
+}
+
+int planOperand(struct operand *op, char *line, long *cursors){
+	// Read the next token as an operand.  Returns as parseOperand(), or NOT_FOUND if the token is in error
+	int error, type = scanToken(line, cursors, &error);
+	return type == NOT_FOUND ? NOT_FOUND : parseOperand(op, type, line, cursors);
+}
+
+int planOperands(char *line, long *cursors, int toComma){
+	// Operands of a print, or of a string assignment, which stops at a comma as varStrAss() does
+	// Returns FALSE if any needs the interpreter
+	struct operand op;
+	for (int type; (!toComma || line[cursors[STOP]] != ',') && (type = planOperand(&op, line, cursors)) != TERMINATOR; addOperand(&op)) if (type == NOT_FOUND) return FALSE;
+	return TRUE;
+}
+
+int planMaths(char *line, long *cursors){
+	// Operators and operands of a maths assignment as varMthAss() reads them, starting with the operator at cursors
+	// Returns FALSE if any needs the interpreter
+	struct operand op;
+	int error, type;
+	do {
+		char sign = line[cursors[START]];
+		if (sign == 0 || strchr("+-*/%", sign) == NULL || (type = planOperand(&op, line, cursors)) == TERMINATOR || type == NOT_FOUND) return FALSE;
+		op.op = sign;
+		addOperand(&op);
+	} while ((type = scanToken(line, cursors, &error)) != TERMINATOR && type != NOT_FOUND);
+	return type == TERMINATOR;
+}
+
+int planTests(char *line, long *cursors){
+	// Condition of an 'if' or 'elif' as comparator() reads it.  Returns FALSE if any part needs the interpreter
+	struct test test;
+	int error, type;
+	do {
+		if ((type = planOperand(&test.a, line, cursors)) == TERMINATOR || type == NOT_FOUND) return FALSE;
+		if ((test.operator = scanToken(line, cursors, &error)) != VARIABLE && (test.operator < LE || test.operator > NE)) return FALSE;
+		test.inc = test.operator == VARIABLE && substringEquals("inc", line, cursors);
+		if ((type = planOperand(&test.b, line, cursors)) == TERMINATOR || type == NOT_FOUND) return FALSE;
+		if ((type = scanToken(line, cursors, &error)) == NOT_FOUND) return FALSE;
+		test.link = type == TERMINATOR ? 0 : substringEquals("and", line, cursors) ? 'a' : substringEquals("or", line, cursors) ? 'o' : 0;
+		addTest(&test);
+	} while (test.link);
+	return TRUE;
+}
 
-			struct fieldDict *field = &fields.dict[addr];
+int readsVar(struct operand *op, int var){
+	return op->type == VARIABLE && op->addr == var || op->type == FIELD_ITER && op->indexVar == var;
+}
 
-			// Get delimiter
-			if (getNextToken(scriptLine, cursors) == QUOTE) {
-				field->len = cursors[STOP] - cursors[START];
-				field->val = substringSave(NULL, scriptLine, cursors);
+int planColumns(FILE *scriptFile){
+	// Read the loop body, up to its 'out', into a plan with an entry for each statement
+	// Returns FALSE if the body needs the interpreter, which includes any statement it would reject
+	struct columnBuffers *col = &grain->columns;
+	int lines, var, type, error;
+	col->entryCount = col->operandCount = col->testCount = col->spanCount = col->resultCount = 0;
+	for (lines = 0; ; ++lines){
+		if (lines == col->lineCap){
+			col->lineCap = col->lineCap ? 2 * col->lineCap : 16;
+			col->lines = realloc(col->lines, col->lineCap * sizeof(char *));
+			col->lineEntry = realloc(col->lineEntry, col->lineCap * sizeof(int));
+			col->lineKind = realloc(col->lineKind, col->lineCap * sizeof(char));
+			for (int l = lines; l < col->lineCap; ++l) col->lines[l] = malloc((READ_SIZE + 1) * sizeof(char));
+		}
+		char *line = col->lines[lines];
+		long c[2] = {0, -1};
+		if (fgets(line, READ_SIZE + 1, scriptFile) == NULL) return FALSE;
+		col->lineEntry[lines] = col->entryCount;
+		col->lineKind[lines] = 0;
+
+		if ((type = scanToken(line, c, &error)) == NOT_FOUND) return FALSE;
+		else if (type == TERMINATOR) continue;
+		else if (substringEquals("out", line, c)) break;
+		else if (substringEquals("print", line, c)){
+			addEntry(PRINT);
+			if (!planOperands(line, c, FALSE)) return FALSE;
+		}
+		else if (substringEquals("if", line, c)){
+			col->lineKind[lines] = 'i';
+			addEntry(TEST);
+			if (!planTests(line, c)) return FALSE;
+		}
+		else if (substringEquals("elif", line, c) || substringEquals("else", line, c)){
+			// Run on from the branch before, either skips to the 'fi'.  A failed test jumps past the skip to an 'elif' test.
+			col->lineKind[lines] = substringEquals("elif", line, c) ? 'e' : 'l';
+			addEntry(SKIP);
+			if (col->lineKind[lines] == 'e' && (addEntry(TEST), !planTests(line, c))) return FALSE;
+		}
+		else if (substringEquals("fi", line, c)) col->lineKind[lines] = 'f';
+		else if (substringEquals("var", line, c)){
+			// A single variable, which must already exist: creating it is left to the interpreter
+			if (scanToken(line, c, &error) == NOT_FOUND || findFieldIter(line, c) != NOT_FOUND || findFileIter(line, c) != NOT_FOUND) return FALSE;
+			if ((var = findVar(line, c)) == NOT_FOUND || isBorrowed(var) || line[c[STOP]] != '=' && line[c[STOP]] != 0 && strchr("+-/*%", line[c[STOP]]) != NULL) return FALSE;
+			else if (line[c[STOP]] == '=' || (type = scanToken(line, c, &error)) == ASSIGNMENT){
+				addEntry(STR_ASS);
+				if (!planOperands(line, c, TRUE)) return FALSE;
 			}
-			else if (scriptLine[cursors[START]] != ')'){
-				field->val = stringSave(NULL, vars.dict[findVar(scriptLine, cursors)].val);
-				for (field->len = 0; field->val[field->len] != 0; ++field->len);
+			else if (type == MATHS){
+				if (line[c[STOP]] != '=') return FALSE;
+				addEntry(MTH_ASS);
+				col->entries[col->entryCount - 1].declared = TRUE;
+				if (!planMaths(line, c)) return FALSE;
 			}
-			else {  // No delimiter provided.  Default = whitespace	
-				field->len = 0;
-				field->val = NULL;
+			else if (type == NOT_FOUND) return FALSE;
+			else addEntry(STR_ASS);
+			col->entries[col->entryCount - 1].var = var;
+			if (line[c[START]] == ',' || line[c[STOP]] == ',') return FALSE;
+		}
+		else if (substringEquals("file", line, c) || substringEquals("follow", line, c) || substringEquals("cache", line, c) || substringEquals("field", line, c)
+		      || substringEquals("in", line, c) || substringEquals("cont", line, c) || substringEquals("break", line, c) || substringEquals("exit", line, c)) return FALSE;
+		else {
+			if ((var = findVar(line, c)) == NOT_FOUND || isBorrowed(var)) return FALSE;
+			else if (line[c[STOP]] == '=' || (type = scanToken(line, c, &error)) == ASSIGNMENT){
+				addEntry(STR_ASS);
+				if (!planOperands(line, c, TRUE)) return FALSE;
+			}
+			else if (type == NOT_FOUND) return FALSE;
+			else {
+				addEntry(MTH_ASS);
+				if (!planMaths(line, c)) return FALSE;
 			}
+			col->entries[col->entryCount - 1].var = var;
 		}
-		else if (substringEquals("in", scriptLine, cursors)){
-			do {
-				if (++loops.ptr == loops.cap){
-					++loops.cap;
-					loops.stack = realloc(loops.stack, loops.cap * sizeof(struct loopStruct));
-				}
-
-				struct loopStruct *loop = &loops.stack[loops.ptr];
+	}
 
-				// Save cmd
-				loop->cmd = -1;
+	// Jumps, found as nextIf() and the 'elif' and 'else' statements find them: by the first line of the right kind,
+	// whatever the nesting.  One that would leave the body is left to the interpreter.
+	for (int l = 0, next; l < lines; ++l){
+		char kind = col->lineKind[l];
+		if (kind == 'i' || kind == 'e'){
+			for (next = l + 1; next < lines && (col->lineKind[next] == 0 || col->lineKind[next] == 'i'); ++next);
+			if (next == lines) return FALSE;
+			col->entries[col->lineEntry[l] + (kind == 'e')].jump = col->lineKind[next] == 'e' ? col->lineEntry[next] + 1 : col->lineEntry[next + 1];
+		}
+		if (kind == 'e' || kind == 'l'){
+			for (next = l + 1; next < lines && col->lineKind[next] != 'f'; ++next);
+			if (next == lines) return FALSE;
+			col->entries[col->lineEntry[l]].jump = col->lineEntry[next + 1];
+		}
+	}
 
-				// Get type and addr
-				getNextToken(scriptLine, cursors);
-				loop->addr = findFileIter(scriptLine, cursors);
-				if ( loop->type = (loop->addr == NOT_FOUND) ) {
-					if (!loops.ptr) throwError(NO_FILE_ITER, scriptLine, cursors[START], cursors[STOP]);
-					loop->addr = findFieldIter(scriptLine, cursors);
-				}
+	// A variable assigned may be read by no other statement, nor assigned by one, so that running the body a statement
+	// at a time leaves it as running it a record at a time would.  A maths assignment may read its own variable.
+	for (int e = 0; e < col->entryCount; ++e){
+		struct columnEntry *entry = &col->entries[e];
+		if (entry->type != STR_ASS && entry->type != MTH_ASS) continue;
+		for (int f = 0; f < col->entryCount; ++f){
+			struct columnEntry *other = &col->entries[f];
+			if (f != e && (other->type == STR_ASS || other->type == MTH_ASS) && other->var == entry->var) return FALSE;
+			else if (other->type == TEST){
+				for (struct test *test = &col->tests[other->first]; test < &col->tests[other->first + other->count]; ++test) if (readsVar(&test->a, entry->var) || readsVar(&test->b, entry->var)) return FALSE;
+			}
+			else for (struct operand *op = &col->operands[other->first]; op < &col->operands[other->first + other->count]; ++op){
+				if (readsVar(op, entry->var) && (f != e || entry->type == STR_ASS || op->type != VARIABLE)) return FALSE;
+			}
+		}
+	}
 
-				// Get index
-				if (scriptLine[cursors[STOP]] == '['){
-					loop->isLoop = FALSE;
-					getNextToken(scriptLine, cursors);
-					loop->index = (int)token2Num(scriptLine, cursors);
-				}
-				else {
-					loop->isLoop = TRUE;
-					loop->index = loop->type == FIELD_ITER? -1 : 0;
-				}
+	// Batch buffers, for this plan
+	if (col->records == NULL){
+		col->records = malloc(2 * COLUMN_RECORDS * sizeof(long));
+		col->saved = malloc(COLUMN_RECORDS * sizeof(char));
+		col->next = malloc(COLUMN_RECORDS * sizeof(int));
+	}
+	if (col->entryCount) col->ran = realloc(col->ran, col->entryCount * COLUMN_RECORDS * sizeof(char));
+	if (col->spanCount) col->spans = realloc(col->spans, 2 * col->spanCount * COLUMN_RECORDS * sizeof(long));
+	if (col->resultCount) col->results = realloc(col->results, col->resultCount * COLUMN_RECORDS * sizeof(struct number));
+	return TRUE;
+}
 
-				loop->chain = FALSE; 
-				loops = resetLoop(scriptLine, scriptFile);
+struct loopStruct columnRecord(int addr, long base, int r){
+	// Record r of the batch, as the loop the interpreter would have pushed for it.  base is the batch's file offset
+	long start = grain->columns.records[2 * r];
+	return (struct loopStruct){.type = FILE_ITER, .addr = addr, .buff = &grain->files.dict[addr].batch[start], .stop = grain->columns.records[2 * r + 1] - start, .origin = base + start};
+}
 
-			} while ( loops.ptr != -1 && (loops.stack[loops.ptr].chain = (scriptLine[cursors[STOP]] == '.')) );
+int columnValue(struct operand *op, struct loopStruct *record, long *curs, char **txt, int raise){
+	// operandValue(), raising a missing field as retrieveToken() does if raise.  Otherwise returns FALSE for it
+	if (operandValue(op, record, curs, txt)) return TRUE;
+	else if (raise) throwError(OOR, grain->fields.dict[op->addr].key, op->index, FIELD_ITER);
+	return FALSE;
+}
 
-			if (loops.ptr == NO_LOOP) endLoop(scriptLine, scriptFile);
+int runEntry(int e, struct loopStruct *record, int r, int raise){
+	// Run entry e of the plan over record r of the batch.  Returns the entry the record runs next
+	// If raise, runs it as the interpreter runs its statement: printing, assigning, and raising any error
+	// Otherwise nothing is printed or assigned, spans and results are saved for the record, and NOT_FOUND is returned
+	// where the interpreter would raise an error
+	struct columnBuffers *col = &grain->columns;
+	struct columnEntry *entry = &col->entries[e];
+	struct operand *op = &col->operands[entry->first];
+	struct number augend = {TRUE, 0, 0}, addend;
+	long curs[2], length = 0;
+	long long x, y;
+	char *txt, buff[NUM_SIZE];
+	switch (entry->type){
+	case PRINT:
+		for ( ; op < &col->operands[entry->first + entry->count]; ++op){
+			if (!columnValue(op, record, curs, &txt, raise)) return NOT_FOUND;
+			else if (raise && curs[START] == STRING) printSubstring(txt, 0, strlen(txt));
+			else if (raise) printSubstring(txt, curs[START], curs[STOP]);
+			else if (op->slot != NOT_FOUND) memcpy(&col->spans[2 * (op->slot * COLUMN_RECORDS + r)], curs, 2 * sizeof(long));
 		}
-		else if (substringEquals("out", scriptLine, cursors) || substringEquals("cont", scriptLine, cursors)){
-			loops = loadLoop(scriptLine, scriptFile);
+		return e + 1;
+	case TEST:
+		for (struct test *test = &col->tests[entry->first]; ; ++test){
+			long cursB[2];
+			char *txtB;
+			if (!columnValue(&test->a, record, curs, &txt, raise) || !columnValue(&test->b, record, cursB, &txtB, raise)) return NOT_FOUND;
+			int result = compareResult(txt, curs, txtB, cursB, test->operator, test->inc);
+			if (result ? test->link != 'a' : test->link != 'o') return result ? e + 1 : entry->jump;
 		}
-		else if (substringEquals("cont", scriptLine, cursors)){
-			loops = loadLoop(scriptLine, scriptFile);
-			if (loops.ptr == NO_LOOP) endLoop(scriptLine, scriptFile);
+	case SKIP:
+		return entry->jump;
+	case STR_ASS:
+		for ( ; op < &col->operands[entry->first + entry->count]; ++op){
+			if (!columnValue(op, record, curs, &txt, raise)) return NOT_FOUND;
+			else if (raise) length = scratchJoin(length, txt, curs[START], curs[STOP]);
 		}
-		else if (substringEquals("if", scriptLine, cursors)){
-			while (comparator(scriptLine, cursors) == FALSE   &&   nextIf(scriptLine, scriptFile, cursors) == FALSE);
+		if (raise) varSet(entry->var, length ? grain->scratch.txt : "", length);
+		return e + 1;
+	default:
+		// As varMthAss(), but unless raise the variable is read from, and written to, the entry
+		if (raise && entry->declared) varSet(entry->var, "0", 1);
+		if (raise) augend = string2Number(grain->vars.dict[entry->var].val);
+		else if (!entry->declared && !entry->readable) return NOT_FOUND;
+		else if (!entry->declared) augend = entry->now;
+		for ( ; op < &col->operands[entry->first + entry->count]; ++op){
+			if (!raise && op->type == VARIABLE && op->addr == entry->var) addend = entry->declared ? (struct number){TRUE, 0, 0} : entry->now;
+			else if (!columnValue(op, record, curs, &txt, raise)) return NOT_FOUND;
+			else if (!raise && !(curs[START] == STRING ? isNumber(txt, 0, strlen(txt)) : isNumber(txt, curs[START], curs[STOP]))) return NOT_FOUND;
+			else addend = curs[START] == STRING ? string2Number(txt) : substring2Number(txt, curs);
+			if (!raise && op->op == '%' && (!wholeOf(augend, &x) || !wholeOf(addend, &y) || y == 0)) return NOT_FOUND;
+			augend = numberOp(augend, op->op, addend);
+		}
+		if (raise) varSet(entry->var, buff, formatNumber(buff, augend));
+		else col->results[entry->slot * COLUMN_RECORDS + r] = augend, entry->now = roundNumber(augend), entry->readable = isPlain(augend);
+		return e + 1;
+	}
+}
+
+int columnLoop(char *scriptLine, long *cursors, FILE *scriptFile){
+	// Run an 'in' loop over every record of a file a batch at a time, and each batch a statement at a time: every
+	// statement of the body runs over the batch before the next starts.  Tests send each record on to the statement
+	// it runs next, maths assignments run down a column of numbers, and prints gather the fields they located into
+	// one write.  Output, variables and errors are as running the body a record at a time would leave them.
+	// Returns FALSE, with the script at the loop body, for a loop planColumns() cannot plan
+	long curs[2] = {cursors[START], cursors[STOP]};
+	int addr;
+	if (getNextToken(scriptLine, curs) != VARIABLE || (addr = findFileIter(scriptLine, curs)) == NOT_FOUND || scriptLine[curs[STOP]] == '[' || scriptLine[curs[STOP]] == '.' || getNextToken(scriptLine, curs) != TERMINATOR) return FALSE;
+	struct fileDict *file = &grain->files.dict[addr];
+	if (file->whole || file->len == 0 || file->to != NO_LIMIT || file->checkpoint != NULL) return FALSE;
+	long resume = ftell(scriptFile);
+	if (planColumns(scriptFile) == FALSE){
+		fseek(scriptFile, resume, SEEK_SET);
+		return FALSE;
+	}
+
+	struct columnBuffers *col = &grain->columns;
+	long length = 0;
+	char buff[NUM_SIZE];
+	for (int done = FALSE; !done; ){
+		// Split: find the complete records in the batch, refilling when there is none
+		int records = 0;
+		long found;
+		for (long pos = file->batchPos; records < COLUMN_RECORDS && (found = getNextField(file->batch, file->delimiter, pos, file->batchLen)) != NOT_FOUND; pos = found + file->len){
+			col->records[2 * records] = pos, col->records[2 * records++ + 1] = found;
 		}
-		else if (substringEquals("elif", scriptLine, cursors) || substringEquals("else", scriptLine, cursors)){
-			for (fgets(scriptLine, READ_SIZE + 1, scriptFile) ; substringEquals("fi", scriptLine, cursors) == FALSE; fgets(scriptLine, READ_SIZE + 1, scriptFile), cursors[STOP]=-1, getNextToken(scriptLine, cursors));
+		if (records == 0){
+			// A record too large for the batch is left to loadFile() to map.  The loop carries on in the interpreter.
+			if (file->mappable && file->batchLen - file->batchPos >= MAP_SIZE){
+				fseek(scriptFile, resume, SEEK_SET);
+				return FALSE;
+			}
+			if (fillBatch(file) > 0) continue;
+			else if (file->batchPos == file->batchLen) break;
+			// Unterminated final record
+			col->records[0] = file->batchPos, col->records[1] = file->batchLen;
+			records = 1, done = TRUE;
 		}
-		else if (substringEquals("break", scriptLine, cursors)){
-			do {
-				if (loops.stack[loops.ptr].type == FILE_ITER) free(loops.stack[loops.ptr].buff);
-			} while ( --loops.ptr >= 0 && loops.stack[loops.ptr].chain == TRUE);
 
-			endLoop(scriptLine, scriptFile);
+		// Terminate every record in place, as loadFile() would have copied it.  Maths assignments start from their variables
+		long base = ftell(file->fp) - file->batchLen;
+		for (int r = 0; r < records; ++r) col->saved[r] = file->batch[col->records[2 * r + 1]], file->batch[col->records[2 * r + 1]] = 0;
+		for (struct columnEntry *entry = col->entries; entry < &col->entries[col->entryCount]; ++entry){
+			char *val = entry->type == MTH_ASS ? grain->vars.dict[entry->var].val : NULL;
+			if (val != NULL && (entry->readable = isNumber(val, 0, strlen(val)))) entry->now = string2Number(val);
 		}
-		else if (substringEquals("exit", scriptLine, cursors)){
-			break;
+		if (col->entryCount) memset(col->ran, 0, col->entryCount * COLUMN_RECORDS * sizeof(char));
+		memset(col->next, 0, records * sizeof(int));
+
+		// Run each entry over the records that reach it.  The first record the interpreter would fail on ends the batch.
+		int limit = records, failed = NOT_FOUND, failedEntry = NOT_FOUND;
+		for (int e = 0; e < col->entryCount; ++e) for (int r = 0; r < limit; ++r){
+			if (col->next[r] != e) continue;
+			struct loopStruct record = columnRecord(addr, base, r);
+			if ((col->next[r] = runEntry(e, &record, r, FALSE)) == NOT_FOUND) failed = limit = r, failedEntry = e;
+			else col->ran[e * COLUMN_RECORDS + r] = TRUE;
 		}
-		else if (substringEquals("fi", scriptLine, cursors) == FALSE){
-			int destAddr = findVar(scriptLine, cursors);
-			if (destAddr == NOT_FOUND){
-				int err;
-				if ((err=findFieldIter(scriptLine, cursors)) != NOT_FOUND) throwError(ASSIGN, fields.dict[err].key, FIELD_ITER, -1);
-				else if ((err=findFileIter(scriptLine, cursors)) != NOT_FOUND) throwError(ASSIGN, files.dict[err].key, FILE_ITER, -1);
-				else throwError(NOT_EXIST, scriptLine, cursors[START], cursors[STOP]);
-			}
 
-			if (scriptLine[cursors[STOP]] == '=' || getNextToken(scriptLine, cursors) == ASSIGNMENT){
-				char *newVar = varStrAss(scriptLine, cursors);
-				free(vars.dict[destAddr].val);
-				vars.dict[destAddr].val = newVar;
+		// Gather the output of the records run, in order
+		int end = failed == NOT_FOUND ? records : failed + 1;
+		for (int r = 0; r < end; ++r){
+			long start = col->records[2 * r];
+			for (int e = 0; e < col->entryCount; ++e){
+				struct columnEntry *entry = &col->entries[e];
+				if (entry->type != PRINT || !col->ran[e * COLUMN_RECORDS + r]) continue;
+				for (struct operand *op = &col->operands[entry->first]; op < &col->operands[entry->first + entry->count]; ++op){
+					long *span = op->type == FIELD_ITER ? &col->spans[2 * (op->slot * COLUMN_RECORDS + r)] : NULL;
+					if (op->type == QUOTE) length = scratchJoin(length, op->txt, op->start, op->stop);
+					else if (op->type == VARIABLE) length = scratchJoin(length, grain->vars.dict[op->addr].val, STRING, 0);
+					else if (op->type == DOLLAR) length = scratchJoin(length, file->batch, start, start + strlen(&file->batch[start]));
+					else length = scratchJoin(length, file->batch, start + span[START], start + span[STOP]);
+				}
 			}
+			if (length >= SCAN_SIZE) printSubstring(grain->scratch.txt, 0, length), length = 0;
+		}
+		if (length) printSubstring(grain->scratch.txt, 0, length), length = 0;
+
+		// Leave each variable as the last record to assign it did
+		for (int e = 0; e < col->entryCount; ++e){
+			struct columnEntry *entry = &col->entries[e];
+			int r = end - 1;
+			if (entry->type != STR_ASS && entry->type != MTH_ASS) continue;
+			while (r >= 0 && !col->ran[e * COLUMN_RECORDS + r]) --r;
+			if (r < 0) continue;
+			else if (entry->type == MTH_ASS) varSet(entry->var, buff, formatNumber(buff, col->results[entry->slot * COLUMN_RECORDS + r]));
 			else {
-				vars.dict[destAddr].val = varMthAss(destAddr, scriptLine, cursors);
+				struct loopStruct record = columnRecord(addr, base, r);
+				runEntry(e, &record, r, TRUE);
 			}
 		}
+		for (int r = 0; r < records; ++r) file->batch[col->records[2 * r + 1]] = col->saved[r];
+
+		// Consume the records run, including one that failed
+		file->origin = base + col->records[2 * (end - 1)];
+		file->batchPos = done ? file->batchLen : col->records[2 * (end - 1) + 1] + file->len;
+		file->metrics.records += end;
+		if (failed != NOT_FOUND){
+			// Run the rest of the failed record as the interpreter would, on a copy as loadFile() would have made,
+			// raising the error
+			long start = col->records[2 * failed], stop = col->records[2 * failed + 1];
+			char *copy = malloc((stop - start + 1) * sizeof(char));
+			int slot = own(copy);
+			memcpy(copy, &file->batch[start], stop - start);
+			copy[stop - start] = 0;
+			struct loopStruct record = {.type = FILE_ITER, .addr = addr, .buff = copy, .stop = stop - start, .origin = base + start};
+			for (int e = failedEntry; e < col->entryCount; ) e = runEntry(e, &record, failed, TRUE);
+			free(copy), disown(slot);
+		}
 	}
-	// CLEAN UP
-	fclose(scriptFile);
-
-	// Free loop buffers
-	for ( ; loops.ptr > -1; --loops.ptr) if (loops.stack[loops.ptr].type == FILE_ITER) free(loops.stack[loops.ptr].buff);
-	if (loops.stack != NULL) free(loops.stack);
+	return TRUE;
+}
 
-	// Free variables
-	for (int var=0; var < vars.count; ++var) free(vars.dict[var].key), free(vars.dict[var].val);
-	if (vars.dict != NULL) free(vars.dict);
+int runLine(char *scriptLine, FILE *scriptFile){
+	// Execute one line of script
+	// Returns FALSE if the script should exit
+	long cursors[2] = {0, -1};
+	if (getNextToken(scriptLine, cursors) == TERMINATOR) return TRUE;
+	else if (substringEquals("var", scriptLine, cursors)){
+		do {
+			getNextToken(scriptLine, cursors);
+			int addr;
+			if ((addr = findFieldIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, grain->fields.dict[addr].key, FIELD_ITER, -1);
+			else if ((addr = findFileIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, grain->files.dict[addr].key, FILE_ITER, -1);
+			else if ((addr = findVar(scriptLine, cursors)) == NOT_FOUND) addr = newVar(scriptLine, cursors);
+			else checkBorrowed(addr);
+		
+			switch(scriptLine[cursors[STOP]]){
+			case '=':
+				// String assignment without whitespace
+				varStrAss(addr, scriptLine, cursors);
+				break;
+			case '+':
+			case '-':
+			case '/':
+			case '*':
+			case '%':
+				// Maths assignment without whitespace
+				if (scriptLine[cursors[STOP]+1] != '=') throwError(NO_EQUALS, &scriptLine[cursors[STOP]+1], -1, -1);
+				varSet(addr, "0", 1);
+				varMthAss(addr, scriptLine, cursors);
+				break;
+			default:
+				switch(getNextToken(scriptLine,cursors)){
+				case ASSIGNMENT:
+					// String assignment with whitespace
+					varStrAss(addr, scriptLine, cursors);
+					break;
+				case MATHS:
+					// Maths assignment with whitespace
+					if (scriptLine[cursors[STOP]] != '=') throwError(NO_EQUALS, &scriptLine[cursors[STOP]], -1, -1);
+					varSet(addr, "0", 1);
+					varMthAss(addr, scriptLine, cursors);
+					break;
+				default:
+					// No assignment: initialise empty variable
+					varSet(addr, "", 0);
+					break;
+				}
+			}
+		} while (scriptLine[cursors[START]] == ',' || scriptLine[cursors[STOP]] == ','); // Multiple comma-separated var declarations
+	}
+	else if (substringEquals("print", scriptLine, cursors)){
+		char *buff;
+		int freeBuff;
+	long printCurs[2];
+		while ( (freeBuff=retrieveToken(printCurs, &buff, scriptLine, cursors)) != TERMINATOR){
+			if (printCurs[START] == NOT_FOUND) printSubstring(buff, 0, strlen(buff));
+			else printSubstring(buff, printCurs[START], printCurs[STOP]);
+			if (freeBuff == TRUE) freeRecord(buff);
+		}
+	}
+	else if (substringEquals("file", scriptLine, cursors)){
+		// Get name
+		getNextToken(scriptLine, cursors);
 
-	// Free file iterators
-	for (int file=0; file < files.count; ++file) free(files.dict[file].key), free(files.dict[file].delimiter), fclose(files.dict[file].fp);
-	if (files.dict != NULL) free(files.dict);
+		int addr;
+		if ((addr = findVar(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, grain->vars.dict[addr].key, VAR, -1);
+		else if ((addr = findFieldIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, grain->fields.dict[addr].key, FIELD_ITER, -1);
+		else if ((addr = findFileIter(scriptLine, cursors)) == NOT_FOUND){
+			// Allocate new file iterator
+			addr = grain->files.count++;
+			grain->files.dict = realloc(grain->files.dict, grain->files.count * sizeof(struct fileDict));
+			grain->files.dict[addr].key = substringSave(NULL, scriptLine, cursors);
+			memset(&grain->files.dict[addr].metrics, 0, sizeof(struct fileMetrics));
+		}
+		else {
+			// Clear/Close this file iterator
+			if (grain->files.dict[addr].checkpoint != NULL) saveCheckpoint(&grain->files.dict[addr]);
+			free(grain->files.dict[addr].checkpoint);
+			free(grain->files.dict[addr].batch);
+			freeSidecar(&grain->files.dict[addr]);
+			free(grain->files.dict[addr].name);
+			free(grain->files.dict[addr].delimiter);
+			fclose(grain->files.dict[addr].fp);
+		}
 
-	// Free field iterators
-	for (int field=0; field < fields.count; ++field) free(fields.dict[field].key), free(fields.dict[field].val);
-	if (fields.dict != NULL) free(fields.dict);
+		struct fileDict *file = &grain->files.dict[addr];
+		file->from = 0;
+		file->to = NO_LIMIT;
+		file->checkpoint = NULL;
+		file->wait = 0;
+		file->whole = FALSE;
+		file->batch = NULL;
+		file->batchCap = file->batchLen = file->batchPos = 0;
+		file->cache = NULL;
+		file->delimiter = NULL;
+
+		// Get filename
+		if (getNextToken(scriptLine, cursors) == QUOTE) file->name = substringSave(NULL, scriptLine, cursors);
+		else file->name = stringSave(NULL, grain->vars.dict[findVar(scriptLine, cursors)].val);
+		file->fp = grain->open != NULL ? grain->open(grain->openUser, file->name) : fopen(file->name, "r");
+		if (file->fp == NULL) throwError(NO_FILE, file->name, -1, -1);
+		struct stat info;
+		file->mappable = fstat(fileno(file->fp), &info) == 0 && S_ISREG(info.st_mode);
+		file->metrics.size = file->mappable ? info.st_size : -1;
+		++file->metrics.opens;
+
+		// Get delimiter
+		if (scriptLine[cursors[STOP]] == ',' || getNextToken(scriptLine, cursors) == COMMA){
+			switch(getNextToken(scriptLine, cursors)){
+			case QUOTE:
+				file->len = cursors[STOP] - cursors[START];
+				file->delimiter = substringSave(NULL, scriptLine, cursors);
+				file->whole = (file->len == 1 && file->delimiter[0] == '*');
+				break;
+			case MATHS:
+				if (scriptLine[cursors[START]] != '*') ; // throw some kind of error
+				else {	// load entire file
+					file->len = 1;
+					file->delimiter = stringSave(NULL, "*");
+					file->whole = TRUE;
+					break;
+				}
+			case DOLLAR:
+				// What if they put a file segment into a file segment?
+				// retrieveToken() might be a better choice for this switch statement
+			case VARIABLE:
+				file->delimiter = stringSave(NULL, grain->vars.dict[findVar(scriptLine, cursors)].val);
+				for (file->len = 0; file->delimiter[file->len] != 0; ++file->len);
+			default:
+				// Raise invalid token error
+			}
 
+			// Get byte range
+			if (scriptLine[cursors[STOP]] == ',' || getNextToken(scriptLine, cursors) == COMMA){
+				getNextToken(scriptLine, cursors);
+				file->from = token2Long(scriptLine, cursors);
+				if (scriptLine[cursors[STOP]] == ',' || getNextToken(scriptLine, cursors) == COMMA){
+					getNextToken(scriptLine, cursors);
+					file->to = token2Long(scriptLine, cursors);
+				}
+			}
+		}
+		else {  // No delimiter provided.  Default = newline (\n)
+			file->len = 1;
+			file->delimiter = malloc(2 * sizeof(char));
+			file->delimiter[0] = '\n';
+			file->delimiter[1] = 0;
+		}
+
+		// Byte ranges are found by seeking, which a stream cannot do
+		if ((file->from > 0 || file->to != NO_LIMIT) && ftell(file->fp) < 0) throwError(NO_SEEK, file->key, -1, -1);
+		seekRange(file);
+	}
+	else if (substringEquals("follow", scriptLine, cursors)){
+		// Get file iterator
+		getNextToken(scriptLine, cursors);
+		int addr;
+		if ((addr = findFileIter(scriptLine, cursors)) == NOT_FOUND) throwError(NOT_EXIST, scriptLine, cursors[START], cursors[STOP]);
+		struct fileDict *file = &grain->files.dict[addr];
+		if (ftell(file->fp) < 0) throwError(NO_SEEK, file->key, -1, -1);
+		free(file->checkpoint);
+
+		// Get checkpoint filename
+		if (getNextToken(scriptLine, cursors) == QUOTE) file->checkpoint = substringSave(NULL, scriptLine, cursors);
+		else file->checkpoint = stringSave(NULL, grain->vars.dict[findVar(scriptLine, cursors)].val);
+
+		// Get polling interval
+		if (scriptLine[cursors[STOP]] == ',' || getNextToken(scriptLine, cursors) == COMMA){
+			getNextToken(scriptLine, cursors);
+			file->wait = (int)token2Long(scriptLine, cursors);
+		}
+		else file->wait = 0;
+
+		loadCheckpoint(file);
+	}
+	else if (substringEquals("cache", scriptLine, cursors)){
+		// Get file and field iterators
+		getNextToken(scriptLine, cursors);
+		int addr, fieldAddr;
+		if ((addr = findFileIter(scriptLine, cursors)) == NOT_FOUND) throwError(NOT_EXIST, scriptLine, cursors[START], cursors[STOP]);
+		getNextToken(scriptLine, cursors);
+		if ((fieldAddr = findFieldIter(scriptLine, cursors)) == NOT_FOUND) throwError(NOT_EXIST, scriptLine, cursors[START], cursors[STOP]);
+		struct fileDict *file = &grain->files.dict[addr];
+		if (ftell(file->fp) < 0) throwError(NO_SEEK, file->key, -1, -1);
+		freeSidecar(file);
+
+		// Get sidecar filename
+		char *path;
+		if (getNextToken(scriptLine, cursors) == QUOTE) path = substringSave(NULL, scriptLine, cursors);
+		else path = stringSave(NULL, grain->vars.dict[findVar(scriptLine, cursors)].val);
+
+		// Use sidecar if still valid, otherwise rebuild it
+		struct stat info;
+		int slot = own(path);
+		if (stat(file->name, &info) == 0 && mapSidecar(file, fieldAddr, path, &info) == FALSE){
+			writeSidecar(file, fieldAddr, path, &info);
+			mapSidecar(file, fieldAddr, path, &info);
+		}
+		free(path), disown(slot);
+	}
+	else if (substringEquals("field", scriptLine, cursors)){
+		// Get name
+		getNextToken(scriptLine, cursors);
+		int addr;
+		if ((addr = findVar(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, grain->vars.dict[addr].key, VAR, -1);
+		else if ((addr = findFileIter(scriptLine, cursors)) != NOT_FOUND) throwError(EXISTS, grain->files.dict[addr].key, FILE_ITER, -1);
+		else if ((addr=findFieldIter(scriptLine, cursors)) == NOT_FOUND){
+			addr = grain->fields.count++;
+			grain->fields.dict = realloc(grain->fields.dict, grain->fields.count * sizeof(struct fieldDict));
+			grain->fields.dict[addr].key = substringSave(NULL, scriptLine, cursors);
+		}
+		else {
+			// Cached offsets no longer match the new delimiter
+			free(grain->fields.dict[addr].val);
+			for (int f=0; f < grain->files.count; ++f) if (grain->files.dict[f].cache != NULL && grain->files.dict[f].cache->field == addr) freeSidecar(&grain->files.dict[f]);
+		}
+
+		struct fieldDict *field = &grain->fields.dict[addr];
+
+		// Get delimiter
+		if (getNextToken(scriptLine, cursors) == QUOTE) {
+			field->len = cursors[STOP] - cursors[START];
+			field->val = substringSave(NULL, scriptLine, cursors);
+		}
+		else if (scriptLine[cursors[START]] != ')'){
+			field->val = stringSave(NULL, grain->vars.dict[findVar(scriptLine, cursors)].val);
+			for (field->len = 0; field->val[field->len] != 0; ++field->len);
+		}
+		else {  // No delimiter provided.  Default = whitespace	
+			field->len = 0;
+			field->val = NULL;
+		}
+	}
+	else if (substringEquals("in", scriptLine, cursors)){
+		if (scriptFile != NULL && columnLoop(scriptLine, cursors, scriptFile)) ;
+		else if (beginLoop(scriptLine, cursors, scriptFile) == FALSE) endLoop(scriptLine, scriptFile);
+	}
+	else if (substringEquals("out", scriptLine, cursors) || substringEquals("cont", scriptLine, cursors)){
+		grain->loops = loadLoop(scriptLine, scriptFile);
+	}
+	else if (substringEquals("cont", scriptLine, cursors)){
+		grain->loops = loadLoop(scriptLine, scriptFile);
+		if (grain->loops.ptr == NO_LOOP) endLoop(scriptLine, scriptFile);
+	}
+	else if (substringEquals("if", scriptLine, cursors)){
+		while (comparator(scriptLine, cursors) == FALSE   &&   nextIf(scriptLine, scriptFile, cursors) == FALSE);
+	}
+	else if (substringEquals("elif", scriptLine, cursors) || substringEquals("else", scriptLine, cursors)){
+		// Skip to the end of the if block
+		do if (fgets(scriptLine, READ_SIZE + 1, scriptFile) == NULL) throwError(NO_FI, NULL, -1, -1);
+		while (cursors[STOP] = -1, getNextToken(scriptLine, cursors), substringEquals("fi", scriptLine, cursors) == FALSE);
+	}
+	else if (substringEquals("break", scriptLine, cursors)){
+		breakLoop();
+		endLoop(scriptLine, scriptFile);
+	}
+	else if (substringEquals("exit", scriptLine, cursors)){
+		return FALSE;
+	}
+	else if (substringEquals("fi", scriptLine, cursors) == FALSE){
+		int destAddr = findVar(scriptLine, cursors);
+		if (destAddr == NOT_FOUND){
+			int err;
+			if ((err=findFieldIter(scriptLine, cursors)) != NOT_FOUND) throwError(ASSIGN, grain->fields.dict[err].key, FIELD_ITER, -1);
+			else if ((err=findFileIter(scriptLine, cursors)) != NOT_FOUND) throwError(ASSIGN, grain->files.dict[err].key, FILE_ITER, -1);
+			else throwError(NOT_EXIST, scriptLine, cursors[START], cursors[STOP]);
+		}
+		checkBorrowed(destAddr);
+
+		if (scriptLine[cursors[STOP]] == '=' || getNextToken(scriptLine, cursors) == ASSIGNMENT){
+			varStrAss(destAddr, scriptLine, cursors);
+		}
+		else {
+			varMthAss(destAddr, scriptLine, cursors);
+		}
+	}
+	return TRUE;
+}
+
+void runStatement(char *line){
+	// Compiled script: execute a statement the compiler left to the interpreter
+	char scriptLine[READ_SIZE + 1];
+	strcpy(scriptLine, line);
+	runLine(scriptLine, NULL);
+}
+
+int runCondition(char *line){
+	// Compiled script: evaluate the condition of an 'if' or 'elif' statement
+	char scriptLine[READ_SIZE + 1];
+	long cursors[2] = {0, -1};
+	strcpy(scriptLine, line);
+	getNextToken(scriptLine, cursors);
+	return comparator(scriptLine, cursors);
+}
+
+int runIn(char *line){
+	// Compiled script: push an 'in' statement's iterators.  Returns TRUE if the body should run
+	char scriptLine[READ_SIZE + 1];
+	long cursors[2] = {0, -1};
+	strcpy(scriptLine, line);
+	getNextToken(scriptLine, cursors);
+	return beginLoop(scriptLine, cursors, NULL);
+}
+
+int runOut(int base){
+	// Compiled script: advance the loop whose chain starts at base.  Returns TRUE if the body should run again
+	grain->loops = loadLoop(NULL, NULL);
+	return grain->loops.ptr >= base;
+}
+
+int lookup(int *addr, char *name, int type){
+	// Compiled script: address of the variable, file or field iterator called name, found on first use
+	if (*addr != NOT_FOUND) return *addr;
+	char key[READ_SIZE + 1];
+	long cursors[2] = {0, strlen(name)};
+	strcpy(key, name);
+	*addr = type == VAR ? findVar(key, cursors) : type == FILE_ITER ? findFileIter(key, cursors) : findFieldIter(key, cursors);
+	if (*addr == NOT_FOUND) throwError(NOT_EXIST, key, cursors[START], cursors[STOP]);
+	return *addr;
+}
+
+int fieldLookup(int *addr, char *name){
+	// Compiled script: field iterator read from the innermost loop
+	lookup(addr, name, FIELD_ITER);
+	if (grain->loops.ptr == NO_LOOP) throwError(NO_FILE_ITER, grain->fields.dict[*addr].key, -1, -1);
+	return *addr;
+}
+
+int fieldLink(int *addr, char *name){
+	// Compiled script: field iterator looped over by an 'in' chain
+	if (grain->loops.ptr == NO_LOOP) throwError(NO_FILE_ITER, name, -1, -1);
+	return lookup(addr, name, FIELD_ITER);
+}
+
+void declareVar(int *addr, char *name){
+	// Compiled script: 'var' statement.  Creates the variable unless it exists
+	long cursors[2] = {0, strlen(name)};
+	if (*addr == NOT_FOUND && (*addr = findVar(name, cursors)) == NOT_FOUND) *addr = newVar(name, cursors);
+	else checkBorrowed(*addr);
+}
+
+void assignVar(int *addr, char *name){
+	lookup(addr, name, VAR);
+	checkBorrowed(*addr);
+}
+
+int isPlain(struct number num){
+	// TRUE if formatNumber() writes num as digits that read back as a number
+	return num.isWhole || num.real > -1e100 && num.real < 1e100;
+}
+
+struct number roundNumber(struct number num){
+	// num as it reads back once written to a variable
+	char buff[NUM_SIZE];
+	if (num.isWhole || !isPlain(num)) return num;
+	return parseNumber(buff, 0, formatNumber(buff, num), -1, -1);
+}
+
+struct number varNumber(int *addr, char *name){
+	return string2Number(grain->vars.dict[lookup(addr, name, VAR)].val);
+}
+
+struct number localNumber(int *addr, char *name, struct number num){
+	// Compiled script: number held in a C local, as string2Number() would read it from the variable
+	char buff[NUM_SIZE];
+	lookup(addr, name, VAR);
+	if (!isPlain(num)) formatNumber(buff, num), throwError(NOT_NUM, buff, -1, -1);
+	return num;
+}
+
+void setNumber(int addr, struct number num){
+	char buff[NUM_SIZE];
+	varSet(addr, buff, formatNumber(buff, num));
+}
+
+void syncNumber(int addr, struct number num){
+	// Compiled script: copy a C local into its variable, before a statement the interpreter runs
+	if (addr != NOT_FOUND) setNumber(addr, num);
+}
+
+void setText(int addr, long length){
+	varSet(addr, length ? grain->scratch.txt : "", length);
+}
+
+void literalValue(struct value *val, char *txt, long length, int isNum, struct number num){
+	val->txt = txt, val->curs[START] = 0, val->curs[STOP] = length;
+	val->isNum = isNum, val->num = num;
+}
+
+void dollarValue(struct value *val){
+	if (grain->loops.ptr == NO_LOOP) throwError(NO_BUFFER, NULL, -1, -1);
+	struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
+	val->txt = loop->buff, val->isNum = FALSE;
+	if (loop->type == FIELD_ITER) val->curs[START] = loop->start, val->curs[STOP] = loop->stop;
+	else val->curs[START] = STRING;
+}
+
+void fieldValue(struct value *val, int addr, int index){
+	struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
+	val->txt = loop->buff, val->isNum = FALSE;
+	val->curs[START] = skipCached(loop->type == FILE_ITER ? &grain->files.dict[loop->addr] : NULL, loop->origin, loop->buff, addr, index, loop->start, loop->stop);
+	if (val->curs[START] == NOT_FOUND) throwError(OOR, grain->fields.dict[addr].key, index, FIELD_ITER);
+	if ((val->curs[STOP] = getNextField(loop->buff, grain->fields.dict[addr].val, val->curs[START], loop->stop)) == NOT_FOUND) val->curs[STOP] = loop->stop;
+}
+
+void varValue(struct value *val, int *addr, char *name){
+	val->txt = grain->vars.dict[lookup(addr, name, VAR)].val, val->curs[START] = STRING, val->isNum = FALSE;
+}
+
+void localValue(struct value *val, int *addr, char *name, struct number num){
+	// Text is only written if needed, unless num will not read back as a number
+	lookup(addr, name, VAR);
+	val->num = num, val->isNum = isPlain(num), val->txt = NULL;
+	if (!val->isNum) formatNumber(val->buff, num), val->txt = val->buff, val->curs[START] = STRING;
+}
+
+void valueText(struct value *val){
+	if (val->txt == NULL) formatNumber(val->buff, val->num), val->txt = val->buff, val->curs[START] = STRING;
+}
+
+struct number valueNumber(struct value *val){
+	if (val->isNum) return val->num;
+	return val->curs[START] == STRING ? string2Number(val->txt) : substring2Number(val->txt, val->curs);
+}
+
+void printValue(struct value *val){
+	valueText(val);
+	if (val->curs[START] == STRING) printSubstring(val->txt, 0, strlen(val->txt));
+	else printSubstring(val->txt, val->curs[START], val->curs[STOP]);
+}
+
+long joinValue(long length, struct value *val){
+	valueText(val);
+	return scratchJoin(length, val->txt, val->curs[START], val->curs[STOP]);
+}
+
+int compareValues(struct value *a, struct value *b){
+	// compareTokens(), skipping the text of values already held as numbers.  Negative numbers compare as text
+	int aIsNum = a->isNum ? (a->num.isWhole ? a->num.whole >= 0 : a->num.real >= 0) : a->curs[START] == STRING ? stringIsNum(a->txt) : substringIsNum(a->txt, a->curs[START], a->curs[STOP]);
+	int bIsNum = b->isNum ? (b->num.isWhole ? b->num.whole >= 0 : b->num.real >= 0) : b->curs[START] == STRING ? stringIsNum(b->txt) : substringIsNum(b->txt, b->curs[START], b->curs[STOP]);
+	if (aIsNum && bIsNum) return compareNumbers(valueNumber(a), valueNumber(b));
+	valueText(a), valueText(b);
+	return compareTokens(a->txt, a->curs, b->txt, b->curs);
+}
+
+int pushLink(int base, int type, int addr, int index, int isLoop, char *txt, int more){
+	// Compiled script: push one iterator of an 'in' chain, as beginLoop() does.  Returns TRUE if the chain goes on
+	if (++grain->loops.ptr == grain->loops.cap){
+		++grain->loops.cap;
+		grain->loops.stack = realloc(grain->loops.stack, grain->loops.cap * sizeof(struct loopStruct));
+	}
+	struct loopStruct *loop = &grain->loops.stack[grain->loops.ptr];
+	loop->cmd = -1;
+	loop->type = type, loop->addr = addr, loop->isLoop = isLoop, loop->chain = FALSE;
+	loop->index = isLoop ? (type == FIELD_ITER ? -1 : 0) : index;
+	loop->buff = type == LITERAL ? stringSave(NULL, txt) : NULL;
+	grain->loops = resetLoop(NULL, NULL);
+	if (grain->loops.ptr < base) return FALSE;
+	grain->loops.stack[grain->loops.ptr].chain = more;
+	return TRUE;
+}
+
+void writeLiteral(FILE *out, char *txt, long length){
+	// Write txt[0-length] as a C string literal.  Anything but printable ASCII is escaped in octal
+	fputc('"', out);
+	for (long pos=0; pos < length; ++pos){
+		unsigned char c = txt[pos];
+		if (c < ' ' || c > '~' || c == '"' || c == '\\' || c == '?') fprintf(out, "\\%03o", c);
+		else fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+void writeNumber(FILE *out, struct number num){
+	if (num.whole == LLONG_MIN) fprintf(out, "(struct number){%d, LLONG_MIN, %a}", num.isWhole, num.real);
+	else fprintf(out, "(struct number){%d, %lldLL, %a}", num.isWhole, num.whole, num.real);
+}
+
+int literalNumber(char *txt, long *cursors, struct number *num){
+	// TRUE if literal txt[START-STOP] reads as a finite number, which is saved in num
+	long from = cursors[START] + (cursors[START] < cursors[STOP] && txt[cursors[START]] == '-');
+	if (!substringIsNum(txt, from, cursors[STOP])) return FALSE;
+	*num = substring2Number(txt, cursors);
+	return num->real - num->real == 0;
+}
+
+int nameChar(char c){
+	return c >= '0' && c <= '9' || c >= 'A' && c <= 'Z' || c >= 'a' && c <= 'z' || c == '_';
+}
+
+int isMention(char *line, char *key){
+	// TRUE if key appears in line as a whole word
+	int length = strlen(key);
+	for (char *pos = strstr(line, key); pos != NULL; pos = strstr(pos + 1, key))
+		if ((pos == line || !nameChar(pos[-1])) && !nameChar(pos[length])) return TRUE;
+	return FALSE;
+}
+
+int findName(struct compiler *comp, char *txt, long *cursors){
+	for (int name=0; name < comp->nameCount; ++name) if (substringEquals(comp->names[name].key, txt, cursors)) return name;
+	return NOT_FOUND;
+}
+
+void declareName(struct compiler *comp, char *txt, long *cursors, int kind){
+	int name = findName(comp, txt, cursors);
+	if (name == NOT_FOUND){
+		name = comp->nameCount++;
+		comp->names = realloc(comp->names, comp->nameCount * sizeof(struct nameDict));
+		comp->names[name] = (struct nameDict){substringSave(NULL, txt, cursors), kind, kind == VAR};
+	}
+	else if (comp->names[name].kind != kind) comp->names[name].kind = NOT_FOUND, comp->names[name].local = FALSE;
+}
+
+int declareNames(struct compiler *comp, char *line, long *cursors){
+	// Note what each 'file', 'field' and 'var' statement declares.  Every name after 'var' or a comma is taken as a variable
+	int type, isName = TRUE;
+	if (substringEquals("file", line, cursors) || substringEquals("field", line, cursors)){
+		int kind = substringEquals("file", line, cursors) ? FILE_ITER : FIELD_ITER;
+		if (getNextToken(line, cursors) == VARIABLE) declareName(comp, line, cursors, kind);
+	}
+	else if (substringEquals("var", line, cursors)){
+		while ((type = getNextToken(line, cursors)) != TERMINATOR){
+			if (isName && type == VARIABLE) declareName(comp, line, cursors, VAR);
+			isName = (type == COMMA || line[cursors[STOP]] == ',');
+		}
+	}
+	return TRUE;
+}
+
+void writeName(struct compiler *comp, int name){
+	writeLiteral(comp->out, comp->names[name].key, strlen(comp->names[name].key));
+}
+
+int compileIndex(struct compiler *comp, char *line, long *cursors){
+	// Write the index of an iterator, as token2Num() reads it.  Returns FALSE if it is left to the interpreter
+	struct number num;
+	int name;
+	switch (getNextToken(line, cursors)){
+	case NUMBER:
+		if (!literalNumber(line, cursors, &num) || num.real < 0 || num.real > INT_MAX) return FALSE;
+		fprintf(comp->out, "%d", (int)num.real);
+		return TRUE;
+	case VARIABLE:
+		if ((name = findName(comp, line, cursors)) == NOT_FOUND || comp->names[name].kind != VAR) return FALSE;
+		if (comp->names[name].local) fprintf(comp->out, "(int)localNumber(&a%d, ", name), writeName(comp, name), fprintf(comp->out, ", n%d).real", name);
+		else fprintf(comp->out, "(int)varNumber(&a%d, ", name), writeName(comp, name), fputs(").real", comp->out);
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+int compileOperand(struct compiler *comp, char *line, long *cursors, int slot){
+	// Write C that loads the next token into v[slot], as retrieveToken() does
+	// Returns TRUE, QUOTE for a literal left to the caller, TERMINATOR, or FALSE if the token is left to the interpreter
+	int name;
+	switch (getNextToken(line, cursors)){
+	case DOLLAR:
+		if (line[cursors[START]] != '$') return FALSE;
+		fprintf(comp->out, "dollarValue(&v[%d]), ", slot);
+		return TRUE;
+	case NUMBER:
+	case QUOTE:
+		return QUOTE;
+	case VARIABLE:
+		if (line[cursors[STOP]] == '(' || (name = findName(comp, line, cursors)) == NOT_FOUND) return FALSE;
+		else if (line[cursors[STOP]] == '['){
+			if (comp->names[name].kind != FIELD_ITER) return FALSE;
+			fprintf(comp->out, "fieldLookup(&a%d, ", name), writeName(comp, name);
+			fprintf(comp->out, "), fieldValue(&v[%d], a%d, ", slot, name);
+			if (compileIndex(comp, line, cursors) == FALSE) return FALSE;
+			fputs("), ", comp->out);
+		}
+		else if (comp->names[name].kind != VAR) return FALSE;
+		else if (comp->names[name].local) fprintf(comp->out, "localValue(&v[%d], &a%d, ", slot, name), writeName(comp, name), fprintf(comp->out, ", n%d), ", name);
+		else fprintf(comp->out, "varValue(&v[%d], &a%d, ", slot, name), writeName(comp, name), fputs("), ", comp->out);
+		return TRUE;
+	case COMMA:
+	case TERMINATOR:
+		return TERMINATOR;
+	default:
+		return FALSE;
+	}
+}
+
+int compileValue(struct compiler *comp, char *line, long *cursors, int slot){
+	// compileOperand(), with literals loaded into v[slot] too
+	struct number num;
+	int result = compileOperand(comp, line, cursors, slot), isNum;
+	if (result != QUOTE) return result;
+	if ((isNum = substringIsNum(line, cursors[START], cursors[STOP]) && literalNumber(line, cursors, &num)) == FALSE) num = (struct number){FALSE, 0, 0};
+	fprintf(comp->out, "literalValue(&v[%d], ", slot);
+	writeLiteral(comp->out, &line[cursors[START]], cursors[STOP] - cursors[START]);
+	fprintf(comp->out, ", %ld, %d, ", cursors[STOP] - cursors[START], isNum);
+	writeNumber(comp->out, num);
+	fputs("), ", comp->out);
+	return TRUE;
+}
+
+int compilePrint(struct compiler *comp, char *line, long *cursors){
+	int result;
+	while ((result = compileOperand(comp, line, cursors, 0)) != TERMINATOR){
+		if (result == FALSE) return FALSE;
+		else if (result == TRUE) fputs("printValue(&v[0]); ", comp->out);
+		else {
+			fputs("printSubstring(", comp->out);
+			writeLiteral(comp->out, &line[cursors[START]], cursors[STOP] - cursors[START]);
+			fprintf(comp->out, ", 0, %ld); ", cursors[STOP] - cursors[START]);
+		}
+	}
+	return TRUE;
+}
+
+int compileStrAss(struct compiler *comp, char *line, long *cursors, int name){
+	// Write a string assignment, as varStrAss() runs it.  A C local may only be assigned a number as the interpreter writes it
+	struct number num;
+	char buff[NUM_SIZE];
+	int result, count = 0, isNum = FALSE;
+	FILE *out = comp->out;
+	comp->out = comp->spare;
+	rewind(comp->spare);
+	while (line[cursors[STOP]] != ',' && (result = compileOperand(comp, line, cursors, 0)) != TERMINATOR){
+		if (result == FALSE) return FALSE;
+		else if (result == TRUE) fputs("length = joinValue(length, &v[0]); ", comp->out);
+		else {
+			isNum = count == 0 && literalNumber(line, cursors, &num) && formatNumber(buff, num) == cursors[STOP] - cursors[START]
+				&& memcmp(buff, &line[cursors[START]], cursors[STOP] - cursors[START]) == 0;
+			fputs("length = scratchJoin(length, ", comp->out);
+			writeLiteral(comp->out, &line[cursors[START]], cursors[STOP] - cursors[START]);
+			fprintf(comp->out, ", 0, %ld); ", cursors[STOP] - cursors[START]);
+		}
+		++count;
+	}
+	comp->out = out;
+	long length = ftell(comp->spare);
+	fflush(comp->spare);
+
+	if (count != 1 || !isNum) comp->names[name].local = FALSE;
+	if (comp->names[name].local) fprintf(out, "n%d = ", name), writeNumber(out, num), fputs("; ", out);
+	else {
+		fputs("length = 0; ", out);
+		fwrite(comp->spareTxt, sizeof(char), length, out);
+		fprintf(out, "setText(a%d, length); ", name);
+	}
+	return TRUE;
+}
+
+int compileMthAss(struct compiler *comp, char *line, long *cursors, int name, int declared){
+	// Write a maths assignment, as varMthAss() runs it.  A declared variable starts from zero
+	struct number num;
+	int local = comp->names[name].local, result;
+	if (declared && local) fprintf(comp->out, "n%d = (struct number){TRUE, 0, 0}; n = n%d; ", name, name);
+	else if (declared) fprintf(comp->out, "n = (struct number){TRUE, 0, 0}; setNumber(a%d, n); ", name);
+	else if (local) fprintf(comp->out, "n = localNumber(&a%d, ", name), writeName(comp, name), fprintf(comp->out, ", n%d); ", name);
+	else fprintf(comp->out, "n = varNumber(&a%d, ", name), writeName(comp, name), fputs("); ", comp->out);
+	do {
+		char op = line[cursors[START]];
+		if (op == 0 || strchr("+-*/%", op) == NULL) return FALSE;
+		if ((result = compileOperand(comp, line, cursors, 0)) == TRUE) fprintf(comp->out, "n = numberOp(n, '%c', valueNumber(&v[0])); ", op);
+		else if (result == QUOTE && literalNumber(line, cursors, &num)) fprintf(comp->out, "n = numberOp(n, '%c', ", op), writeNumber(comp->out, num), fputs("); ", comp->out);
+		else return FALSE;
+	} while (getNextToken(line, cursors) != TERMINATOR);
+	if (local) fprintf(comp->out, "n%d = roundNumber(n); ", name);
+	else fprintf(comp->out, "setNumber(a%d, n); ", name);
+	return TRUE;
+}
+
+int compileVar(struct compiler *comp, char *line, long *cursors){
+	// Write a 'var' statement, following runLine()
+	int name;
+	do {
+		if (getNextToken(line, cursors) != VARIABLE || (name = findName(comp, line, cursors)) == NOT_FOUND || comp->names[name].kind != VAR) return FALSE;
+		fprintf(comp->out, "declareVar(&a%d, ", name), writeName(comp, name), fputs("); ", comp->out);
+		if (line[cursors[STOP]] == '='){
+			if (compileStrAss(comp, line, cursors, name) == FALSE) return FALSE;
+		}
+		else if (line[cursors[STOP]] != 0 && strchr("+-/*%", line[cursors[STOP]]) != NULL) return FALSE;
+		else switch (getNextToken(line, cursors)){
+			case ASSIGNMENT:
+				if (compileStrAss(comp, line, cursors, name) == FALSE) return FALSE;
+				break;
+			case MATHS:
+				if (line[cursors[STOP]] != '=' || compileMthAss(comp, line, cursors, name, TRUE) == FALSE) return FALSE;
+				break;
+			default:
+				comp->names[name].local = FALSE;
+				fprintf(comp->out, "setText(a%d, 0); ", name);
+		}
+	} while (line[cursors[START]] == ',' || line[cursors[STOP]] == ',');
+	return TRUE;
+}
+
+int compileAssignment(struct compiler *comp, char *line, long *cursors){
+	// Write an assignment to an existing variable, following runLine()
+	int name = findName(comp, line, cursors), type = ASSIGNMENT;
+	if (name == NOT_FOUND || comp->names[name].kind != VAR) return FALSE;
+	fprintf(comp->out, "assignVar(&a%d, ", name), writeName(comp, name), fputs("); ", comp->out);
+	if (line[cursors[STOP]] == '=' || (type = getNextToken(line, cursors)) == ASSIGNMENT) return compileStrAss(comp, line, cursors, name);
+	else return type == MATHS && compileMthAss(comp, line, cursors, name, FALSE);
+}
+
+int compileCondition(struct compiler *comp, char *line, long *cursors){
+	// Write the condition of an 'if' or 'elif' as a C expression, evaluated as comparator() does
+	static char *tests[] = {"<=", "<", ">=", ">", "==", "!="};
+	int operator, andFlag = FALSE, orFlag = FALSE;
+	fputc('(', comp->out);
+	if (compileValue(comp, line, cursors, 0) != TRUE) return FALSE;
+	if ((operator = getNextToken(line, cursors)) < LE || operator > NE) return FALSE;
+	if (compileValue(comp, line, cursors, 1) != TRUE) return FALSE;
+	fprintf(comp->out, "compareValues(&v[0], &v[1]) %s 0)", tests[operator]);
+
+	if (getNextToken(line, cursors) != TERMINATOR && (andFlag = substringEquals("and", line, cursors)) == FALSE)
+		orFlag = substringEquals("or", line, cursors);
+	if (andFlag || orFlag){
+		fputs(andFlag ? " && (" : " || (", comp->out);
+		if (compileCondition(comp, line, cursors) == FALSE) return FALSE;
+		fputc(')', comp->out);
+	}
+	return TRUE;
+}
+
+int compileIf(struct compiler *comp, char *line, long *cursors){
+	fputs("if (", comp->out);
+	if (compileCondition(comp, line, cursors) == FALSE) return FALSE;
+	fputs(") {", comp->out);
+	return TRUE;
+}
+
+int compileElif(struct compiler *comp, char *line, long *cursors){
+	fputs("} else ", comp->out);
+	return compileIf(comp, line, cursors);
+}
+
+int compileIn(struct compiler *comp, char *line, long *cursors){
+	// Write an 'in' statement as a pushLink() per iterator, checked as beginLoop() does.  The body becomes a C loop
+	int link = 0, name, type;
+	fputs("{ int base = grain->loops.ptr + 1; if (", comp->out);
+	do {
+		if (link++) fputs(" && ", comp->out);
+		if ((type = getNextToken(line, cursors)) == QUOTE && link == 1){
+			fputs("pushLink(base, LITERAL, 0, NO_INDEX, FALSE, ", comp->out);
+			writeLiteral(comp->out, &line[cursors[START]], cursors[STOP] - cursors[START]);
+			if (line[++cursors[STOP]] == '[') return FALSE;
+			fprintf(comp->out, ", %d)", line[cursors[STOP]] == '.');
+			continue;
+		}
+		else if (type != VARIABLE || (name = findName(comp, line, cursors)) == NOT_FOUND) return FALSE;
+		else if (comp->names[name].kind == VAR && link == 1){
+			// Loops borrow the variable itself, so it cannot be a C local
+			comp->names[name].local = FALSE;
+			if (line[cursors[STOP]] == '[') return FALSE;
+			fprintf(comp->out, "(lookup(&a%d, ", name), writeName(comp, name);
+			fprintf(comp->out, ", VAR), pushLink(base, VAR, a%d, NO_INDEX, FALSE, NULL, %d))", name, line[cursors[STOP]] == '.');
+			continue;
+		}
+		else if (comp->names[name].kind == FILE_ITER) fprintf(comp->out, "(lookup(&a%d, ", name), writeName(comp, name), fputs(", FILE_ITER), ", comp->out);
+		else if (comp->names[name].kind == FIELD_ITER) fprintf(comp->out, "(fieldLink(&a%d, ", name), writeName(comp, name), fputs("), ", comp->out);
+		else return FALSE;
+
+		fprintf(comp->out, "pushLink(base, %s, a%d, ", comp->names[name].kind == FILE_ITER ? "FILE_ITER" : "FIELD_ITER", name);
+		if (line[cursors[STOP]] == '['){
+			if (compileIndex(comp, line, cursors) == FALSE) return FALSE;
+			++cursors[STOP];
+			fputs(", FALSE", comp->out);
+		}
+		else fputs("0, TRUE", comp->out);
+		fprintf(comp->out, ", NULL, %d))", line[cursors[STOP]] == '.');
+	} while (line[cursors[STOP]] == '.');
+	fputs(") do {", comp->out);
+	return TRUE;
+}
+
+int attempt(struct compiler *comp, int (*parse)(struct compiler *comp, char *line, long *cursors), char *line, long *cursors){
+	// Run parse on a copy of line, writing C to comp->code.  Returns FALSE if parse gives up, or raises an error,
+	// which is left for the interpreter to raise when the script runs
+	char copy[READ_SIZE + 1];
+	long curs[2] = {cursors[START], cursors[STOP]}, result = FALSE;
+	jmp_buf caller;
+	strcpy(copy, line);
+	comp->out = comp->code;
+	rewind(comp->code);
+	memcpy(caller, grain->fail, sizeof(jmp_buf));
+	if (setjmp(grain->fail) == 0) result = parse(comp, copy, curs);
+	memcpy(grain->fail, caller, sizeof(jmp_buf));
+	return result;
+}
+
+int firstToken(char *line, long *cursors){
+	// Statement keyword of line.  Lines starting with a quote are left alone, as getNextToken() would unescape them
+	int pos = 0;
+	while (line[pos] == ' ' || line[pos] == '\t') ++pos;
+	if (line[pos] == '"' || line[pos] == '\'' || line[pos] == '`' || line[pos] == '!'){
+		cursors[START] = cursors[STOP] = pos;
+		return QUOTE;
+	}
+	return getNextToken(line, cursors);
+}
+
+void compileLine(struct compiler *comp, int lineNum, int write){
+	// Translate one line.  Statements the compiler cannot translate, or that may not behave the same, are run by the
+	// interpreter.  write is FALSE for the first pass, which only finds the variables that can be C locals
+	char *line = comp->lines[lineNum];
+	long cursors[2] = {0, -1};
+	int native = FALSE, readOnly = FALSE, name;
+	if (firstToken(line, cursors) == TERMINATOR) return;
+
+	// Closing statements are written one level out
+	int close = substringEquals("out", line, cursors) || substringEquals("fi", line, cursors) || substringEquals("elif", line, cursors) || substringEquals("else", line, cursors);
+	comp->depth -= close;
+	if (write) for (int tab = comp->depth + 1; tab; --tab) fputc('\t', comp->source);
+	comp->depth += substringEquals("in", line, cursors) || substringEquals("if", line, cursors) || substringEquals("elif", line, cursors) || substringEquals("else", line, cursors);
+
+	char *jump = NULL;
+	if (substringEquals("out", line, cursors)) jump = "} while (runOut(base)); }";
+	else if (substringEquals("cont", line, cursors)) jump = "continue;";
+	else if (substringEquals("break", line, cursors)) jump = "breakLoop(); break;";
+	else if (substringEquals("exit", line, cursors)) jump = "return;";
+	else if (substringEquals("else", line, cursors)) jump = "} else {";
+	else if (substringEquals("fi", line, cursors)) jump = "}";
+	if (jump != NULL){
+		if (write) fputs(jump, comp->source);
+		native = TRUE;
+	}
+	else {
+		int (*parse)(struct compiler *comp, char *line, long *cursors) = compileAssignment;
+		if (substringEquals("var", line, cursors)) parse = compileVar;
+		else if (substringEquals("print", line, cursors)) parse = compilePrint, readOnly = TRUE;
+		else if (substringEquals("in", line, cursors)) parse = compileIn;
+		else if (substringEquals("if", line, cursors)) parse = compileIf, readOnly = TRUE;
+		else if (substringEquals("elif", line, cursors)) parse = compileElif, readOnly = TRUE;
+		else if (substringEquals("file", line, cursors) || substringEquals("field", line, cursors) || substringEquals("follow", line, cursors) || substringEquals("cache", line, cursors)) parse = NULL, readOnly = TRUE;
+		if (parse != NULL && attempt(comp, parse, line, cursors)){
+			long length = ftell(comp->code);
+			fflush(comp->code);
+			if (write) fwrite(comp->codeTxt, sizeof(char), length, comp->source);
+			native = TRUE;
+		}
+	}
+	if (native || !write) {
+		// The interpreter may assign any variable a line mentions
+		if (!native && !readOnly) for (name=0; name < comp->nameCount; ++name) if (isMention(line, comp->names[name].key)) comp->names[name].local = FALSE;
+		if (write) fputc('\n', comp->source);
+		return;
+	}
+
+	// Left to the interpreter, which reads variables rather than C locals
+	int elif = substringEquals("elif", line, cursors);
+	fputs(substringEquals("in", line, cursors) ? "{ int base = grain->loops.ptr + 1; " : elif ? "} else if (" : "", comp->source);
+	for (name=0; name < comp->nameCount; ++name)
+		if (comp->names[name].local && isMention(line, comp->names[name].key)) fprintf(comp->source, elif ? "syncNumber(a%d, n%d), " : "syncNumber(a%d, n%d); ", name, name);
+	if (substringEquals("in", line, cursors)) fputs("if (runIn(", comp->source);
+	else if (substringEquals("if", line, cursors)) fputs("if (runCondition(", comp->source);
+	else if (elif) fputs("runCondition(", comp->source);
+	else fputs("runStatement(", comp->source);
+	writeLiteral(comp->source, line, strlen(line));
+	fputs(substringEquals("in", line, cursors) ? ")) do {\n" : substringEquals("if", line, cursors) ? ")) {\n" : elif ? ")) {\n" : ");\n", comp->source);
+}
+
+void compileBody(void *arg){
+	struct compiler *comp = arg;
+	char scriptLine[READ_SIZE + 1];
+	int depth = 0;
+
+	// Read the script, check its blocks match, and note what each name is declared as
+	while (fgets(scriptLine, READ_SIZE + 1, comp->scriptFile) != NULL){
+		long cursors[2] = {0, -1};
+		comp->lines = realloc(comp->lines, (comp->lineCount + 1) * sizeof(char *));
+		comp->lines[comp->lineCount++] = stringSave(NULL, scriptLine);
+		if (firstToken(scriptLine, cursors) == TERMINATOR) continue;
+		attempt(comp, declareNames, scriptLine, cursors);
+
+		if (substringEquals("in", scriptLine, cursors) || substringEquals("if", scriptLine, cursors)){
+			if (depth % 64 == 0) comp->blocks = realloc(comp->blocks, depth + 64);
+			comp->blocks[depth++] = substringEquals("in", scriptLine, cursors) ? 'i' : 'f';
+		}
+		else if (substringEquals("out", scriptLine, cursors)){
+			if (depth == 0) throwError(NO_OUT, NULL, -1, -1);
+			if (comp->blocks[--depth] != 'i') throwError(NO_FI, NULL, -1, -1);
+		}
+		else if (substringEquals("fi", scriptLine, cursors) || substringEquals("elif", scriptLine, cursors) || substringEquals("else", scriptLine, cursors)){
+			if (depth == 0) throwError(NO_FI, NULL, -1, -1);
+			if (comp->blocks[depth-1] != 'f') throwError(NO_OUT, NULL, -1, -1);
+			if (substringEquals("fi", scriptLine, cursors)) --depth;
+		}
+	}
+	if (depth) throwError(comp->blocks[depth-1] == 'i' ? NO_OUT : NO_FI, NULL, -1, -1);
+
+	// First pass finds the variables that can be C locals, second pass writes C
+	for (int lineNum=0; lineNum < comp->lineCount; ++lineNum) compileLine(comp, lineNum, FALSE);
+	fputs("void script(void *arg){\n\tstruct value v[2];\n\tstruct number n;\n\tlong length;\n", comp->source);
+	for (int name=0; name < comp->nameCount; ++name){
+		fprintf(comp->source, "\tint a%d = NOT_FOUND;", name);
+		if (comp->names[name].local) fprintf(comp->source, " struct number n%d = {TRUE, 0, 0};", name);
+		fputc('\n', comp->source);
+	}
+	for (int lineNum=0; lineNum < comp->lineCount; ++lineNum) compileLine(comp, lineNum, TRUE);
+	fputs("}\n\nint main(int argc, char **argv){\n\treturn grainMain(script, NULL, argc > 1 ? openMetrics(argv[1]) : NULL);\n}\n", comp->source);
+}
+
+char *grainSource(){
+	// Location of grain.c: $GRAIN_SOURCE, else the path grain was built from, else beside the grain executable
+	char *env = getenv("GRAIN_SOURCE"), exe[PATH_MAX], *path;
+	if (env != NULL && env[0] != 0) return realpath(env, NULL);
+	if ((path = realpath(GRAIN_SOURCE, NULL)) != NULL) return path;
+	ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe));
+	if (length <= 0 || length + sizeof("grain.c") > sizeof(exe)) return NULL;
+	exe[length] = 0;
+	strcpy(strrchr(exe, '/') + 1, "grain.c");
+	return realpath(exe, NULL);
+}
+
+int grainExecute(struct grain *context, void (*body)(void *arg), void *arg);
+int compileScript(char *scriptName, char *outName){
+	// Translate script into C, then build it with $CC
+	// Returns 0 if the program was built
+	char *name = NULL, *source, *path;
+	struct compiler comp = {0};
+
+	if ((comp.scriptFile = fopen(scriptName, "r")) == NULL){
+		fprintf(stderr, "ERROR: cannot open '%s'.\n", scriptName);
+		return 1;
+	}
+	if ((path = grainSource()) == NULL || strpbrk(path, "\"\\\n") != NULL){
+		fprintf(stderr, "ERROR: cannot find grain.c to compile against.  Set GRAIN_SOURCE to its path.\n");
+		free(path), fclose(comp.scriptFile);
+		return 1;
+	}
+
+	// Default output = script name without its extension
+	if (outName == NULL){
+		outName = name = stringJoin(NULL, scriptName);
+		char *ext = strrchr(name, '.');
+		if (ext != NULL && strchr(ext, '/') == NULL) *ext = 0;
+	}
+	source = stringJoin(stringJoin(NULL, outName), ".c");
+	if ((comp.source = fopen(source, "w")) == NULL){
+		fprintf(stderr, "ERROR: cannot write '%s'.\n", source);
+		free(path), free(name), free(source), fclose(comp.scriptFile);
+		return 1;
+	}
+	fprintf(comp.source, "#define GRAIN_LIBRARY\n#include \"%s\"\n\n", path);
+	free(path);
+
+	comp.code = open_memstream(&comp.codeTxt, &comp.codeSize);
+	comp.spare = open_memstream(&comp.spareTxt, &comp.spareSize);
+	struct grain *context = grainNew();
+	int status = grainExecute(context, compileBody, &comp);
+	if (status) fputs(context->message, stderr);
+	grainFree(context);
+
+	fclose(comp.code), fclose(comp.spare), fclose(comp.scriptFile);
+	free(comp.codeTxt), free(comp.spareTxt);
+	for (int line=0; line < comp.lineCount; ++line) free(comp.lines[line]);
+	for (int n=0; n < comp.nameCount; ++n) free(comp.names[n].key);
+	free(comp.lines), free(comp.names), free(comp.blocks);
+	if (fclose(comp.source) != 0 && status == 0){
+		fprintf(stderr, "ERROR: cannot write '%s'.\n", source);
+		status = NO_FILE + 1;
+	}
+
+	// Build without a shell command line, so names need no quoting.  $CC may hold flags
+	if (status == 0){
+		fflush(NULL);
+		pid_t pid = fork();
+		if (pid == 0){
+			execl("/bin/sh", "sh", "-c", "exec ${CC:-cc} -O2 -o \"$1\" \"$2\"", "sh", outName, source, (char *)NULL);
+			_exit(127);
+		}
+		int result = -1;
+		if (pid < 0 || waitpid(pid, &result, 0) != pid || !WIFEXITED(result) || WEXITSTATUS(result) != 0) status = 1;
+	}
+	free(name), free(source);
+	return status != 0;
+}
+
+void unreadRecords(){
+	// After an error, return followed files to the start of the records still being processed
+	// A checkpoint saved later then resumes from the record that failed, rather than skipping it
+	for (int ptr = grain->loops.ptr; ptr > -1; --ptr){
+		struct loopStruct *loop = &grain->loops.stack[ptr];
+		if (loop->type == FILE_ITER && loop->buff != NULL && grain->files.dict[loop->addr].checkpoint != NULL) fileSeek(&grain->files.dict[loop->addr], loop->origin);
+	}
+}
+
+void clearLoops(){
+	// Free loop buffers left by 'exit' or an error
+	for ( ; grain->loops.ptr > -1; --grain->loops.ptr) if (grain->loops.stack[grain->loops.ptr].type == FILE_ITER || grain->loops.stack[grain->loops.ptr].type == LITERAL) freeRecord(grain->loops.stack[grain->loops.ptr].buff);
+}
+
+struct grain *grainNew(){
+	struct grain *context = calloc(1, sizeof(struct grain));
+	context->loops.ptr = -1;
+	return context;
+}
+
+void grainOutput(struct grain *context, void (*output)(void *user, char *txt, int length), void *user){
+	context->output = output, context->outputUser = user;
+}
+
+void grainInput(struct grain *context, FILE *(*open)(void *user, char *path), void *user){
+	context->open = open, context->openUser = user;
+}
+
+void grainMetrics(struct grain *context, FILE *out, int seconds){
+	context->metrics = out, context->metricsInterval = seconds;
+	context->metricsStart = now(), context->metricsLast = 0;
+}
+
+FILE *openMetrics(char *option){
+	// "--metrics" reports to stderr, "--metrics=file" to file.  NULL if option is something else
+	// A file that cannot be opened is reported and exits, rather than being mistaken for the script
+	if (strncmp(option, "--metrics", 9) != 0) return NULL;
+	FILE *fp = option[9] == '=' ? fopen(&option[10], "w") : stderr;
+	if (fp == NULL){
+		fprintf(stderr, "ERROR: cannot open metrics file '%s'.\n", &option[10]);
+		exit(NO_FILE);
+	}
+	return fp;
+}
+
+char *grainError(struct grain *context){
+	return context->message;
+}
+
+int grainExecute(struct grain *context, void (*body)(void *arg), void *arg){
+	// Run body with context as this thread's running script
+	// Returns 0, or error number + 1
+	struct grain *caller = grain;
+	grain = context;
+	int status = setjmp(context->fail);
+	if (status == 0) body(arg);
+	else unreadRecords();
+	clearLoops();
+	releaseOwned();
+	grain = caller;
+	return status;
+}
+
+void runScript(void *scriptFile){
+	char scriptLine[READ_SIZE + 1];
+	// A final line need not end in a newline
+	while (fgets(scriptLine, READ_SIZE + 1, scriptFile) != NULL)
+		if (runLine(scriptLine, scriptFile) == FALSE) break;
+}
+
+int grainRunFile(struct grain *context, FILE *scriptFile){
+	int status = grainExecute(context, runScript, scriptFile);
+	fclose(scriptFile);
+	return status;
+}
+
+int grainRun(struct grain *context, char *path){
+	FILE *scriptFile = fopen(path, "r");
+	if (scriptFile == NULL){
+		snprintf(context->message, READ_SIZE, "ERROR: cannot open '%s'.\n", path);
+		return NO_FILE + 1;
+	}
+	return grainRunFile(context, scriptFile);
+}
+
+int grainRunString(struct grain *context, char *script){
+	if (script[0] == 0) return 0;
+	FILE *scriptFile = fmemopen(script, strlen(script), "r");
+	if (scriptFile == NULL){
+		snprintf(context->message, READ_SIZE, "ERROR: cannot open script string.\n");
+		return NO_FILE + 1;
+	}
+	return grainRunFile(context, scriptFile);
+}
+
+int grainSetVar(struct grain *context, char *name, char *value){
+	// Create or overwrite a variable.  Returns 0, or error number + 1
+	long cursors[2] = {0, strlen(name)};
+	int addr;
+	struct grain *caller = grain;
+	grain = context;
+	if (findFileIter(name, cursors) != NOT_FOUND || findFieldIter(name, cursors) != NOT_FOUND){
+		snprintf(context->message, READ_SIZE, "ERROR: '%s' already exists as an iterator.\n", name);
+		grain = caller;
+		return EXISTS + 1;
+	}
+	if ((addr = findVar(name, cursors)) == NOT_FOUND) addr = newVar(name, cursors);
+	varSet(addr, value, strlen(value));
+	grain = caller;
 	return 0;
 }
+
+char *grainGetVar(struct grain *context, char *name){
+	// Value of variable, or NULL.  Valid until the variable next changes
+	long cursors[2] = {0, strlen(name)};
+	int addr;
+	struct grain *caller = grain;
+	grain = context;
+	addr = findVar(name, cursors);
+	grain = caller;
+	return addr == NOT_FOUND ? NULL : context->vars.dict[addr].val;
+}
+
+void grainFree(struct grain *context){
+	struct grain *caller = grain;
+	grain = context;
+	clearLoops();
+	reportMetrics(TRUE);
+	if (grain->loops.stack != NULL) free(grain->loops.stack);
+	free(grain->chain.stack), free(grain->owned.list), free(grain->mapped.list);
+	struct columnBuffers *col = &grain->columns;
+	for (int l=0; l < col->lineCap; ++l) free(col->lines[l]);
+	free(col->lines), free(col->lineEntry), free(col->lineKind), free(col->entries), free(col->operands), free(col->tests);
+	free(col->records), free(col->saved), free(col->next), free(col->ran), free(col->spans), free(col->results);
+
+	// Free variables
+	for (int var=0; var < grain->vars.count; ++var){
+		free(grain->vars.dict[var].key);
+		if (grain->vars.dict[var].val != grain->vars.dict[var].small) free(grain->vars.dict[var].val);
+	}
+	if (grain->vars.dict != NULL) free(grain->vars.dict);
+	free(grain->scratch.txt);
+
+	// Free file iterators
+	for (int file=0; file < grain->files.count; ++file){
+		if (grain->files.dict[file].checkpoint != NULL) saveCheckpoint(&grain->files.dict[file]);
+		freeSidecar(&grain->files.dict[file]);
+		free(grain->files.dict[file].key), free(grain->files.dict[file].name), free(grain->files.dict[file].checkpoint), free(grain->files.dict[file].batch), free(grain->files.dict[file].delimiter);
+		if (grain->files.dict[file].fp != NULL) fclose(grain->files.dict[file].fp);
+	}
+	if (grain->files.dict != NULL) free(grain->files.dict);
+
+	// Free field iterators
+	for (int field=0; field < grain->fields.count; ++field) free(grain->fields.dict[field].key), free(grain->fields.dict[field].val);
+	if (grain->fields.dict != NULL) free(grain->fields.dict);
+
+	free(context);
+	grain = caller;
+}
+
+int grainMain(void (*body)(void *arg), void *arg, FILE *metrics){
+	// Run body in a new context as a standalone program.  Returns exit status
+	struct grain *context = grainNew();
+	if (metrics != NULL) grainMetrics(context, metrics, METRICS_INTERVAL);
+	int status = grainExecute(context, body, arg);
+	if (status) fputs(context->message, stderr);
+	grainFree(context);
+	if (metrics != NULL && metrics != stderr) fclose(metrics);
+	return status ? status - 1 : 0;
+}
+
+#ifndef GRAIN_LIBRARY
+struct instance {
+	struct grain *context;	// keeps files, fields and variables between requests
+	char *script;		// script text
+	long mtime;		// modification time of script when read
+	long requests;		// requests run so far in this context
+};
+
+struct served {
+	char *path;		// script path, as sent by the client
+	long mtime;		// modification time of the newest script read
+	int idle, size;		// contexts waiting for a request
+	struct instance *spare;
+};
+
+struct daemon {
+	pthread_mutex_t lock;	// guards scripts, which are shared by every connection
+	int count;
+	struct served *scripts;
+};
+
+struct client {
+	int fd;			// connection to the client
+	int length;		// output waiting to be sent
+	struct daemon *daemon;
+	char buff[SCAN_SIZE];
+};
+
+void sendAll(int fd, char *txt, int length){
+	// Send txt in full.  A peer that has gone away, or stopped reading, is ignored
+	for (int sent; length > 0 && (sent = send(fd, txt, length, MSG_NOSIGNAL)) > 0; txt += sent, length -= sent);
+}
+
+void flushOutput(struct client *client){
+	sendAll(client->fd, client->buff, client->length);
+	client->length = 0;
+}
+
+void sendOutput(void *user, char *txt, int length){
+	// print callback: buffer output for the client, sending it whenever the buffer fills
+	struct client *client = user;
+	if (client->length + length > (int)sizeof(client->buff)) flushOutput(client);
+	if (length >= (int)sizeof(client->buff)) sendAll(client->fd, txt, length);
+	else memcpy(&client->buff[client->length], txt, length), client->length += length;
+}
+
+FILE *openInput(void *user, char *path){
+	// file callback: "-" reads the client's stream
+	return strcmp(path, "-") == 0 ? fdopen(dup(((struct client *)user)->fd), "r") : fopen(path, "r");
+}
+
+void dropInstance(struct instance *instance){
+	grainFree(instance->context);
+	free(instance->script);
+}
+
+int takeInstance(struct daemon *daemon, char *path, struct instance *instance){
+	// Check out a context for the script at path, reading the script into a new one if none is idle
+	// A context runs one request at a time.  Returns FALSE if the script cannot be read
+	struct stat info;
+	if (stat(path, &info) != 0) return FALSE;
+
+	pthread_mutex_lock(&daemon->lock);
+	int addr;
+	for (addr=0; addr < daemon->count && strcmp(daemon->scripts[addr].path, path) != 0; ++addr);
+	if (addr == daemon->count){
+		daemon->scripts = realloc(daemon->scripts, ++daemon->count * sizeof(struct served));
+		daemon->scripts[addr] = (struct served){.path = stringSave(NULL, path), .mtime = info.st_mtime};
+	}
+	// A modified script discards idle contexts.  Busy ones are discarded when they are given back
+	struct served *served = &daemon->scripts[addr];
+	if (served->mtime != info.st_mtime){
+		while (served->idle > 0) dropInstance(&served->spare[--served->idle]);
+		served->mtime = info.st_mtime;
+	}
+	int found = served->idle > 0;
+	if (found) *instance = served->spare[--served->idle];
+	pthread_mutex_unlock(&daemon->lock);
+	if (found) return TRUE;
+
+	// Load script text into a fresh context
+	FILE *fp = fopen(path, "r");
+	if (fp == NULL) return FALSE;
+	*instance = (struct instance){.script = malloc(info.st_size + 1), .mtime = info.st_mtime};
+	instance->script[fread(instance->script, sizeof(char), info.st_size, fp)] = 0;
+	fclose(fp);
+	instance->context = grainNew();
+	return TRUE;
+}
+
+void giveInstance(struct daemon *daemon, char *path, struct instance *instance){
+	// Return a context taken by takeInstance(), keeping it for a later request unless its script has changed
+	pthread_mutex_lock(&daemon->lock);
+	struct served *served = daemon->scripts;
+	while (strcmp(served->path, path) != 0) ++served;
+	int keep = served->mtime == instance->mtime;
+	if (keep){
+		if (served->idle == served->size) served->spare = realloc(served->spare, (served->size = 2 * served->size + 1) * sizeof(struct instance));
+		served->spare[served->idle++] = *instance;
+	}
+	pthread_mutex_unlock(&daemon->lock);
+	if (!keep) dropInstance(instance);
+}
+
+void *serveClient(void *arg){
+	// Connection thread: read one request, run it and send the reply
+	// Request: "script<TAB>input\n".  Reply: output, then a 0 byte, the status and any error message
+	struct client *client = arg;
+	struct timeval timeout = {.tv_sec = CLIENT_TIMEOUT};
+	// A client that stops sending or reading is dropped, rather than holding its thread and context
+	setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	// Read request in blocks.  Each block is peeked first, so any streamed input after the newline is left unread
+	char request[2 * READ_SIZE + 1], *input = NULL, *end = NULL, reply[READ_SIZE + 16];
+	int length = 0, got;
+	while (end == NULL && length < 2 * READ_SIZE && (got = recv(client->fd, &request[length], 2 * READ_SIZE - length, MSG_PEEK)) > 0){
+		if ((end = memchr(&request[length], '\n', got)) != NULL) got = end - &request[length] + 1;
+		if (recv(client->fd, &request[length], got, 0) != got) break;
+		length += got;
+	}
+	request[end != NULL ? length - 1 : length] = 0;
+	if ((input = strchr(request, '\t')) != NULL) *input++ = 0;
+
+	struct instance instance;
+	int status = NO_FILE + 1;
+	// A request that fills the buffer without ending is refused, rather than run with its paths cut short
+	if (end == NULL && length == 2 * READ_SIZE) status = TOO_BIG + 1, snprintf(reply, READ_SIZE, "ERROR: request longer than %i bytes.\n", 2 * READ_SIZE);
+	else if (input == NULL || !takeInstance(client->daemon, request, &instance)) snprintf(reply, READ_SIZE, "ERROR: cannot open '%.400s'.\n", request);
+	else {
+		char requests[24];
+		snprintf(requests, sizeof(requests), "%ld", ++instance.requests);
+		grainOutput(instance.context, sendOutput, client);
+		grainInput(instance.context, openInput, client);
+		grainSetVar(instance.context, "input", input);
+		grainSetVar(instance.context, "request", requests);
+		status = grainRunString(instance.context, instance.script);
+		snprintf(reply, READ_SIZE, "%s", status ? grainError(instance.context) : "");
+		giveInstance(client->daemon, request, &instance);
+	}
+
+	// Send the trailer after any buffered output
+	char trailer[24];
+	sendOutput(client, trailer, snprintf(trailer, sizeof(trailer), "%c%i\n", 0, status) );
+	sendOutput(client, reply, strlen(reply));
+	flushOutput(client);
+	// Shut down, not just closed: a streamed input file may still hold a duplicate
+	shutdown(client->fd, SHUT_RDWR), close(client->fd);
+	free(client);
+	return NULL;
+}
+
+int serve(char *socketPath){
+	// Daemon: run scripts on request from clients connected to socketPath, each connection on its own thread
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	struct stat info;
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+	if (stat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode)) unlink(socketPath);
+	// Only the owner may connect, as clients can have any readable file run through any script
+	mode_t mask = umask(0177);
+	if (server < 0 || bind(server, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(server, 16) != 0){
+		perror(socketPath);
+		return 1;
+	}
+	umask(mask);
+
+	struct daemon daemon = {.lock = PTHREAD_MUTEX_INITIALIZER};
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (int fd; (fd = accept(server, NULL, NULL)) >= 0; ){
+		struct client *client = malloc(sizeof(struct client));
+		pthread_t thread;
+		client->fd = fd, client->length = 0, client->daemon = &daemon;
+		if (pthread_create(&thread, &attr, serveClient, client) != 0) close(fd), free(client);
+	}
+	perror(socketPath);
+	return 1;
+}
+
+int connectServer(char *socketPath, char *scriptPath, char *inputPath){
+	// Client: have the daemon at socketPath run scriptPath over inputPath, or over stdin if inputPath is "-"
+	// Returns the exit status the script would have had
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+	if (server < 0 || connect(server, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+		perror(socketPath);
+		return 1;
+	}
+
+	// Paths are resolved here, as the daemon may run elsewhere
+	char *script = realpath(scriptPath, NULL), *input = strcmp(inputPath, "-") == 0 ? NULL : realpath(inputPath, NULL);
+	char request[2 * PATH_MAX + 3];
+	int length = snprintf(request, sizeof(request), "%s\t%s\n", script == NULL ? scriptPath : script, input == NULL ? inputPath : input);
+	free(script), free(input);
+	sendAll(server, request, length);
+
+	// Forward stdin while relaying output, until the status trailer arrives
+	// Input is only sent when the daemon can accept it, so neither side blocks the other
+	struct pollfd polls[2] = {{.fd = server}, {.fd = -1, .events = POLLIN}};
+	char buff[SCAN_SIZE], pending[SCAN_SIZE], message[READ_SIZE + 16];
+	int messageLen = 0, trailer = FALSE, pendingLen = 0, pendingPos = 0, streaming = strcmp(inputPath, "-") == 0;
+	for ( ; ; ){
+		polls[0].events = POLLIN | (pendingPos < pendingLen ? POLLOUT : 0);
+		polls[1].fd = streaming && pendingPos == pendingLen ? STDIN_FILENO : -1;
+		if (poll(polls, 2, -1) <= 0) break;
+
+		if (polls[1].revents){
+			if ( (pendingLen = read(STDIN_FILENO, pending, sizeof(pending))) <= 0) streaming = FALSE, pendingLen = 0, shutdown(server, SHUT_WR);
+			pendingPos = 0;
+		}
+		if (polls[0].revents & POLLOUT){
+			ssize_t sent = send(server, &pending[pendingPos], pendingLen - pendingPos, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (sent > 0) pendingPos += sent;
+			else streaming = FALSE, pendingPos = pendingLen;	// daemon stopped reading
+		}
+		if (polls[0].revents & (POLLIN | POLLHUP | POLLERR)){
+			ssize_t got = recv(server, buff, sizeof(buff), 0);
+			if (got <= 0) break;
+			char *end = trailer ? buff : memchr(buff, 0, got);
+			if (end == NULL) fwrite(buff, sizeof(char), got, stdout);
+			else {
+				if (!trailer) fwrite(buff, sizeof(char), end - buff, stdout);
+				trailer = TRUE;
+				int rest = got - (end - buff);
+				if (rest > (int)sizeof(message) - 1 - messageLen) rest = sizeof(message) - 1 - messageLen;
+				memcpy(&message[messageLen], end, rest);
+				messageLen += rest;
+			}
+		}
+	}
+	close(server);
+	fflush(stdout);
+
+	// Trailer: 0 byte, status, newline, message
+	message[messageLen] = 0;
+	if (messageLen < 2) return 1;
+	char *text = strchr(&message[1], '\n');
+	int status = atoi(&message[1]);
+	if (text != NULL) fputs(text + 1, stderr);
+	return status ? status - 1 : 0;
+}
+
+int main(int argc, char **argv){
+	if (argc > 2 && strcmp(argv[1], "--compile") == 0) return compileScript(argv[2], argc > 3 ? argv[3] : NULL);
+	if (argc > 2 && strcmp(argv[1], "--serve") == 0) return serve(argv[2]);
+	if (argc > 4 && strcmp(argv[1], "--connect") == 0) return connectServer(argv[2], argv[3], argv[4]);
+
+	FILE *metrics = argc > 1 ? openMetrics(argv[1]) : NULL;
+	if (metrics != NULL) ++argv, --argc;
+
+	FILE *scriptFile = argc > 1 ? fopen(argv[1], "r") : NULL;
+	if (scriptFile == NULL) throwError(NO_FILE, argc > 1 ? argv[1] : "", -1, -1);
+	int status = grainMain(runScript, scriptFile, metrics);
+	fclose(scriptFile);
+	return status;
+}
+#endif
@@ -0,0 +1,39 @@
+#ifndef GRAIN_H
+#define GRAIN_H
+
+#include <stdio.h>
+
+// Embedding API.  Build grain.c with -DGRAIN_LIBRARY and link against it.
+// Each context holds its own files, fields, variables and loops.  Contexts may run on separate threads at once,
+// but a single context must only be used by one thread at a time.
+// Functions returning int return 0 on success, or error number + 1.  See grainError for the message.
+
+struct grain;
+
+struct grain *grainNew();
+void grainFree(struct grain *context);
+
+// print statements call output instead of writing to stdout
+void grainOutput(struct grain *context, void (*output)(void *user, char *txt, int length), void *user);
+
+// file statements call open instead of fopen.  Return NULL if path cannot be opened
+void grainInput(struct grain *context, FILE *(*open)(void *user, char *path), void *user);
+
+// Run a script.  Files, fields and variables remain defined for later runs on the same context
+int grainRun(struct grain *context, char *path);
+int grainRunString(struct grain *context, char *script);
+
+int grainSetVar(struct grain *context, char *name, char *value);
+char *grainGetVar(struct grain *context, char *name);
+char *grainError(struct grain *context);
+
+// Report progress of file iterators to out every few seconds, and a JSON summary when the context is freed
+void grainMetrics(struct grain *context, FILE *out, int seconds);
+
+// Run body in a new context and report any error to stderr.  Used by compiled scripts
+// metrics is NULL, or where to report progress.  openMetrics opens it from a "--metrics[=file]" option,
+// exiting with an error if the file cannot be opened
+int grainMain(void (*body)(void *arg), void *arg, FILE *metrics);
+FILE *openMetrics(char *option);
+
+#endif